@@ -0,0 +1,226 @@
+#ifndef CONFIGDISPATCH_H
+#define CONFIGDISPATCH_H
+using namespace std;
+#include "parm.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Precompiled configurations and the runtime dispatcher that picks one of them from command-line
+// or config-file values. A configuration is a struct deriving from DefaultConfig that overrides the
+// parameters it changes; add it to PrecompiledConfigs to make it selectable.
+
+// Four windows per subflow, for links with short-lived steady periods; Q keeps the 200-window minimum
+struct ShortSubflowConfig : DefaultConfig {
+    static constexpr const char* NAME = "short-subflow";
+    static constexpr int SUBFLOW_WINDOWS = 4;
+    static constexpr int MIN_SUBFLOWS = 4;
+    static constexpr int Q = 50;
+};
+
+// More rows in Stage1 and Stage2, for links with many concurrent flows per byte of sketch memory
+struct WideConfig : DefaultConfig {
+    static constexpr const char* NAME = "wide";
+    static constexpr int STAGE1_ROWS = 4;
+    static constexpr int STAGE2_ROWS = 3;
+};
+
+// Tighter stability thresholds, for links where only very regular flows are of interest
+struct StrictConfig : DefaultConfig {
+    static constexpr const char* NAME = "strict";
+    static constexpr int ALPHA_THRESHOLD = 5;
+    static constexpr float STABLE_THRESHOLD = 2.0f;
+};
+
+// One Stage2 row, so the same Stage2 budget buys twice the width
+struct NarrowConfig : DefaultConfig {
+    static constexpr const char* NAME = "narrow";
+    static constexpr int STAGE2_ROWS = 1;
+};
+
+// Sixteen smaller Stage3 buckets instead of four large ones
+struct FineStage3Config : DefaultConfig {
+    static constexpr const char* NAME = "fine-stage3";
+    static constexpr int STAGE3_BUCKETS = 16;
+};
+
+// 16-bit Stage2 counters, for heavy links where 8-bit counters wrap several times per window and
+// fail checkStability; the 128-bit buckets halve the number of buckets in the same Stage2 budget
+struct HeavyLinkConfig : DefaultConfig {
+    static constexpr const char* NAME = "heavy-link";
+    static constexpr int COUNTER_BITS = 16;
+};
+
+template <class... Configs>
+struct ConfigList {};
+
+using PrecompiledConfigs =
+    ConfigList<DefaultConfig, ShortSubflowConfig, WideConfig, StrictConfig, NarrowConfig, FineStage3Config,
+               HeavyLinkConfig>;
+
+// Runtime view of a configuration's parameters
+struct SketchParameters {
+    int subflowWindows = SUBFLOW_WINDOWS;
+    int minSubflows = MIN_SUBFLOWS;
+    int counterBits = COUNTER_BITS;
+    int alphaThreshold = ALPHA_THRESHOLD;
+    float stableThreshold = STABLE_THRESHOLD;
+    int p = P;
+    int q = Q;
+    int stage1Rows = STAGE1_ROWS;
+    int stage2Rows = STAGE2_ROWS;
+    int stage3Buckets = STAGE3_BUCKETS;
+    // Memory split: constructor arguments, so any split works with every configuration
+    size_t stage1Bytes = STAGE1_MEMORY_BYTES;
+    size_t stage2Bytes = STAGE2_MEMORY_BYTES;
+    size_t stage3Bytes = STAGE3_MEMORY_BYTES;
+
+    template <class Config>
+    static SketchParameters of() {
+        SketchParameters params;
+        params.subflowWindows = Config::SUBFLOW_WINDOWS;
+        params.minSubflows = Config::MIN_SUBFLOWS;
+        params.counterBits = Config::COUNTER_BITS;
+        params.alphaThreshold = Config::ALPHA_THRESHOLD;
+        params.stableThreshold = Config::STABLE_THRESHOLD;
+        params.p = Config::P;
+        params.q = Config::Q;
+        params.stage1Rows = Config::STAGE1_ROWS;
+        params.stage2Rows = Config::STAGE2_ROWS;
+        params.stage3Buckets = Config::STAGE3_BUCKETS;
+        return params;
+    }
+
+    // Same detection semantics: everything but the table geometry and the memory split
+    bool sameDetection(const SketchParameters& o) const {
+        return subflowWindows == o.subflowWindows && minSubflows == o.minSubflows && counterBits == o.counterBits &&
+               alphaThreshold == o.alphaThreshold && stableThreshold == o.stableThreshold && p == o.p && q == o.q;
+    }
+
+    // Same compiled configuration: the memory split does not take part
+    bool sameConfiguration(const SketchParameters& o) const {
+        return sameDetection(o) && stage1Rows == o.stage1Rows && stage2Rows == o.stage2Rows &&
+               stage3Buckets == o.stage3Buckets;
+    }
+
+    // Set one parameter by name (the parm.h name in lower case, '-' or '_' between words);
+    // returns false for an unknown name or a malformed value
+    bool set(string name, const string& value) {
+        for (auto& c : name) {
+            if (c == '_') c = '-';
+        }
+        char* end = nullptr;
+        if (name == "stable-threshold") {
+            stableThreshold = strtof(value.c_str(), &end);
+            return !value.empty() && *end == 0;
+        }
+        size_t* bytes = name == "stage1-bytes" ? &stage1Bytes
+                      : name == "stage2-bytes" ? &stage2Bytes
+                      : name == "stage3-bytes" ? &stage3Bytes
+                      : nullptr;
+        if (bytes) {
+            *bytes = strtoull(value.c_str(), &end, 0);
+            return !value.empty() && *end == 0 && *bytes > 0;
+        }
+        int* field = name == "subflow-windows" ? &subflowWindows
+                   : name == "min-subflows"    ? &minSubflows
+                   : name == "counter-bits"    ? &counterBits
+                   : name == "alpha-threshold" ? &alphaThreshold
+                   : name == "p"               ? &p
+                   : name == "q"               ? &q
+                   : name == "stage1-rows"     ? &stage1Rows
+                   : name == "stage2-rows"     ? &stage2Rows
+                   : name == "stage3-buckets"  ? &stage3Buckets
+                   : nullptr;
+        if (!field) {
+            return false;
+        }
+        *field = static_cast<int>(strtol(value.c_str(), &end, 0));
+        return !value.empty() && *end == 0;
+    }
+
+    // "name = value" lines; '#' starts a comment. Returns false on the first bad line.
+    bool load(const string& path) {
+        FILE* in = fopen(path.c_str(), "r");
+        if (!in) {
+            return false;
+        }
+        char line[256];
+        bool ok = true;
+        while (ok && fgets(line, sizeof(line), in)) {
+            string text(line);
+            text = text.substr(0, text.find('#'));
+            const size_t eq = text.find('=');
+            auto trim = [](string s) {
+                const size_t first = s.find_first_not_of(" \t\r\n");
+                return first == string::npos ? string() : s.substr(first, s.find_last_not_of(" \t\r\n") - first + 1);
+            };
+            if (eq == string::npos) {
+                ok = trim(text).empty();
+                continue;
+            }
+            ok = set(trim(text.substr(0, eq)), trim(text.substr(eq + 1)));
+        }
+        fclose(in);
+        return ok;
+    }
+
+    void print(FILE* out) const {
+        fprintf(out, "subflow-windows=%d min-subflows=%d counter-bits=%d alpha-threshold=%d stable-threshold=%g "
+                     "p=%d q=%d stage1-rows=%d stage2-rows=%d stage3-buckets=%d",
+                subflowWindows, minSubflows, counterBits, alphaThreshold, stableThreshold, p, q, stage1Rows,
+                stage2Rows, stage3Buckets);
+    }
+
+    // Every parameter as "name = value" lines, the form load reads back
+    void write(FILE* out) const {
+        fprintf(out, "subflow-windows = %d\nmin-subflows = %d\ncounter-bits = %d\nalpha-threshold = %d\n"
+                     "stable-threshold = %g\np = %d\nq = %d\nstage1-rows = %d\nstage2-rows = %d\n"
+                     "stage3-buckets = %d\nstage1-bytes = %zu\nstage2-bytes = %zu\nstage3-bytes = %zu\n",
+                subflowWindows, minSubflows, counterBits, alphaThreshold, stableThreshold, p, q, stage1Rows,
+                stage2Rows, stage3Buckets, stage1Bytes, stage2Bytes, stage3Bytes);
+    }
+};
+
+// Calls visit(Config()) for the configuration in the list compiled with params' parameters;
+// returns false if there is none
+template <class Visitor, class... Configs>
+bool dispatchConfig(const SketchParameters& params, Visitor&& visit, ConfigList<Configs...>) {
+    bool found = false;
+    ((!found && SketchParameters::of<Configs>().sameConfiguration(params) ? (visit(Configs()), found = true) : false), ...);
+    return found;
+}
+
+template <class Visitor>
+bool dispatchConfig(const SketchParameters& params, Visitor&& visit) {
+    return dispatchConfig(params, visit, PrecompiledConfigs());
+}
+
+// Parameters of the configuration in the list called name; returns false if there is none.
+// The memory split in params is kept.
+template <class... Configs>
+bool presetParameters(const string& name, SketchParameters& params, ConfigList<Configs...>) {
+    bool found = false;
+    auto select = [&](SketchParameters preset) {
+        preset.stage1Bytes = params.stage1Bytes;
+        preset.stage2Bytes = params.stage2Bytes;
+        preset.stage3Bytes = params.stage3Bytes;
+        params = preset;
+        found = true;
+    };
+    ((!found && name == Configs::NAME ? (select(SketchParameters::of<Configs>()), true) : false), ...);
+    return found;
+}
+
+inline bool presetParameters(const string& name, SketchParameters& params) {
+    return presetParameters(name, params, PrecompiledConfigs());
+}
+
+template <class... Configs>
+void printConfigs(FILE* out, ConfigList<Configs...>) {
+    ((fprintf(out, "  %-14s ", Configs::NAME), SketchParameters::of<Configs>().print(out), fprintf(out, "\n")), ...);
+}
+
+inline void printConfigs(FILE* out) { printConfigs(out, PrecompiledConfigs()); }
+
+#endif
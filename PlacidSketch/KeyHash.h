@@ -0,0 +1,29 @@
+#ifndef KEYHASH_H
+#define KEYHASH_H
+using namespace std;
+#include "parm.h"
+#include <cstring>
+
+// Cheap flow-key hash for the small direct-mapped tables on the packet path.
+// Multiplication only carries upwards, so slots are taken from the top bits.
+inline uint64_t keyHash64(const char* flowID) {
+    static_assert(KEY_LEN == 16, "keyHash64 mixes the key as two 64-bit words");
+    uint64_t lo, hi;
+    memcpy(&lo, flowID, 8);
+    memcpy(&hi, flowID + 8, 8);
+    return (lo * 0x9e3779b97f4a7c15ull) ^ (hi * 0xc2b2ae3d27d4eb4full);
+}
+
+// Slot in a direct-mapped table of 2^bits entries
+inline uint32_t keySlot(const char* flowID, uint32_t bits) {
+    return bits ? static_cast<uint32_t>(keyHash64(flowID) >> (64 - bits)) : 0;
+}
+
+// Table bits for at most maxEntries entries (rounded down to a power of two)
+inline uint32_t slotBitsFor(size_t maxEntries) {
+    uint32_t bits = 0;
+    while (bits < 32 && (size_t(2) << bits) <= maxEntries) ++bits;
+    return bits;
+}
+
+#endif
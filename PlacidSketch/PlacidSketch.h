@@ -0,0 +1,138 @@
+#ifndef PLACIDSKETCH_H
+#define PLACIDSKETCH_H
+using namespace std;
+#include "parm.h"
+#include "stage1.h"
+#include "stage2.h"
+#include "stage3.h"
+#include "ReorderBuffer.h"
+#include "stats.h"
+#include "latency.h"
+#include "trace.h"
+
+// PlacidSketch: Stage1 filter -> Stage2 monitor -> Stage3 merger
+template <class Config = DefaultConfig>
+class PlacidSketch {
+private:
+    static_assert(Config::MIN_SUBFLOWS == Config::SUBFLOW_WINDOWS,
+                  "Stage3 continuity counts MIN_SUBFLOWS windows per Stage2 subflow");
+
+    TableArena tables;  // Every stage's tables, in one arena
+    Stage3Merger<Config> stage3;
+    Stage1Filter<Config> stage1;
+    Stage2Monitor<Config> stage2;
+
+    uint32_t currentWindow = 0;
+    size_t droppedLatePackets = 0;
+    ReorderBuffer reorder;  // Front end for processTimestampedPacket
+#if PLACID_LATENCY
+    PacketLatency latency;
+#endif
+
+    void processPacketUntimed(const char* flowID, uint32_t windowSeq) {
+        // The stages cannot reopen a closed window: a packet for one is dropped
+        if (windowSeq < currentWindow) {
+            ++droppedLatePackets;
+            return;
+        }
+        if (windowSeq != currentWindow) {
+            PLACID_PROBE2(window_rollover, currentWindow, windowSeq);
+            stage1.resetBuckets(currentWindow);
+            stage2.closeWindow(currentWindow, windowSeq);
+            PLACID_STATS_DUMP(currentWindow);
+            currentWindow = windowSeq;
+        }
+
+        if (stage1.processPacket(flowID, windowSeq)) {
+            stage2.processPotentialFlow(flowID, windowSeq);
+        }
+    }
+
+public:
+    // budgetOnly keeps the sketch within the three stage budgets, for comparisons at equal memory: no
+    // promoted-flow cache, pending table or pre-aggregation table, and 4 KB pages so that the arena is
+    // not backed by huge pages beyond what the tables touch
+    explicit PlacidSketch(size_t stage1MemoryBytes = STAGE1_MEMORY_BYTES, 
+                         size_t stage2MemoryBytes = STAGE2_MEMORY_BYTES,
+                         size_t stage3MemoryBytes = STAGE3_MEMORY_BYTES,
+                         uint64_t windowGranularityNs = WINDOW_GRANULARITY_NS,
+                         uint64_t reorderLatenessNs = REORDER_LATENESS_NS,
+                         bool budgetOnly = false)
+        : tables(stage1MemoryBytes + stage2MemoryBytes + stage3MemoryBytes + (budgetOnly ? 0 : TABLE_ARENA_EXTRA_BYTES),
+                 TABLE_ARENA_HUGE_PAGES && !budgetOnly),
+          stage3(STAGE3_RNG_SEED, stage3MemoryBytes, STAGE3_TOP_K, &tables),
+          stage1(stage1MemoryBytes, budgetOnly ? 0 : STAGE1_PROMOTED_CACHE_ENTRIES, STAGE1_PACKED_BUCKETS, &tables),
+          stage2(stage3, stage2MemoryBytes, STAGE2_DELTA_ENCODING, STAGE2_DEFERRED_EVALUATION && !budgetOnly,
+                 STAGE2_AGING, STAGE2_PREAGGREGATION && !budgetOnly, &tables),
+          reorder(windowGranularityNs, reorderLatenessNs) {
+    }
+
+    void processPacket(const Packet& packet) {
+        processPacket(packet.flowID, packet.windowNumber);
+    }
+
+    // Packet given by its flow key (KEY_LEN bytes) and window number
+    void processPacket(const char* flowID, uint32_t windowNumber) {
+#if PLACID_LATENCY
+        // The packet that opens a window is charged with the window-close work and counted in
+        // the closing window's histograms, which are exported right after it
+        const uint32_t closingWindow = currentWindow;
+        const bool windowChange = windowNumber > currentWindow;
+        const size_t subflowsBefore = stage3.subflowsProcessed();
+        const uint64_t start = readCycleCounter();
+        processPacketUntimed(flowID, windowNumber);
+        const uint64_t ticks = readCycleCounter() - start;
+        latency.record(windowChange ? LATENCY_WINDOW_RESET
+                       : stage3.subflowsProcessed() != subflowsBefore ? LATENCY_STAGE3 : LATENCY_NORMAL, ticks);
+        if (windowChange) {
+            latency.dump(closingWindow);
+        }
+#else
+        processPacketUntimed(flowID, windowNumber);
+#endif
+    }
+
+    // Packet given by its flow key and capture timestamp: the window comes from the timestamp, and
+    // the reorder buffer puts loosely ordered packets back in window order before the stages see them
+    void processTimestampedPacket(const char* flowID, uint64_t timestampNs) {
+        reorder.push(flowID, timestampNs, [this](const char* id, uint32_t window) { processPacket(id, window); });
+    }
+
+    // Packets dropped for arriving after their window closed: at the reorder buffer, and packets
+    // handed to processPacket with a window number below the current one
+    size_t latePackets() const { return reorder.latePackets() + droppedLatePackets; }
+    const ReorderBuffer& reorderBuffer() const { return reorder; }
+
+    // Live stability of one flow from Stage3, callable from another thread while this one ingests
+    FlowStability queryFlow(const char* flowID) const { return stage3.queryFlow(flowID); }
+
+    // Current top-k flows from Stage3: most stable windows, and lowest variance; ingest thread only
+    vector<StableFlowReport> topLongestFlows(size_t k) const { return stage3.topLongest(k); }
+    vector<StableFlowReport> topSteadiestFlows(size_t k) const { return stage3.topSteadiest(k); }
+
+    // Stable flows reported by Stage3 since the last drain; after finalizeProcessing(), every report not
+    // drained yet
+    const vector<StableFlowReport>& stableFlows() const { return stage3.reports(); }
+
+    // Hands the reports held by Stage3 to consume(report) and empties its bounded buffer; a live sketch
+    // drains regularly, since reports that find the buffer full are dropped and counted
+    template <class Consume>
+    void drainStableFlows(Consume&& consume) { stage3.drainReports(consume); }
+    size_t droppedStableFlows() const { return stage3.reportsDropped(); }
+
+#if PLACID_LATENCY
+    const PacketLatency& latencyHistograms() const { return latency; }
+#endif
+    void finalizeProcessing() {
+        reorder.flush([this](const char* id, uint32_t window) { processPacket(id, window); });
+        stage1.resetBuckets(currentWindow);
+        stage2.flushAggregates();
+        stage3.finalize();
+        PLACID_STATS_DUMP(currentWindow);
+#if PLACID_LATENCY
+        latency.dump(currentWindow);
+#endif
+    }
+};
+
+#endif
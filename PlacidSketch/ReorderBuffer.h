@@ -0,0 +1,116 @@
+#ifndef REORDERBUFFER_H
+#define REORDERBUFFER_H
+using namespace std;
+#include "parm.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Timestamp windowing for loosely ordered packet streams such as merged multi-queue captures.
+// A packet's window is timestamp / granularity, counted from the window of the first packet seen.
+// Packets are held per window and released window by window, in window order, once a packet more
+// than latenessNs past the end of the window has arrived (the watermark). Within a window they keep
+// their arrival order. At most capacityPackets packets are held: beyond that the oldest open window's
+// packets are passed on early. That window stays open, and its later packets still count in it, until
+// a capacity pass finds it empty and has to pass on a later window: the stages would no longer accept
+// its packets then, so it closes with the empty windows before the one passed on.
+// Packets of a window that is already released are dropped and counted in latePackets().
+class ReorderBuffer {
+public:
+    explicit ReorderBuffer(uint64_t granularityNs = WINDOW_GRANULARITY_NS, uint64_t latenessNs = REORDER_LATENESS_NS,
+                           size_t capacityPackets = REORDER_CAPACITY)
+        : granularity(max<uint64_t>(1, granularityNs)), lateness(latenessNs), capacity(max<size_t>(1, capacityPackets)),
+          slots(lateness / granularity + 2) {}
+
+    // Hands the packets that become releasable to emit(flowID, window), then buffers this one
+    template <class Emit>
+    void push(const char* flowID, uint64_t timestampNs, Emit&& emit) {
+        const uint64_t absolute = timestampNs / granularity;
+        if (!started) {
+            started = true;
+            originWindow = absolute;
+        }
+        if (absolute < originWindow + nextWindow) {
+            ++late;
+            return;
+        }
+        // Every window ending at or before the watermark is complete
+        if (timestampNs >= lateness) {
+            const uint64_t watermark = (timestampNs - lateness) / granularity;
+            while (originWindow + nextWindow < watermark) {
+                release(emit);
+            }
+        }
+        const uint32_t window = static_cast<uint32_t>(absolute - originWindow);
+        BufferedPacket& packet = slots[window % slots.size()].emplace_back();
+        memcpy(packet.flowID, flowID, KEY_LEN);
+        if (++buffered > capacity) {
+            passOldest(emit);
+        }
+        peak = max(peak, buffered);
+    }
+
+    // Releases every buffered window, for the end of the stream
+    template <class Emit>
+    void flush(Emit&& emit) {
+        while (buffered > 0) {
+            release(emit);
+        }
+    }
+
+    size_t latePackets() const { return late; }
+    size_t bufferedPackets() const { return buffered; }
+    size_t peakBufferedPackets() const { return peak; }
+    // Times the capacity bound passed an open window's packets on before its watermark
+    size_t earlyPasses() const { return passes; }
+
+private:
+    struct BufferedPacket {
+        char flowID[KEY_LEN];
+    };
+
+    uint64_t granularity;
+    uint64_t lateness;
+    size_t capacity;
+    // Windows nextWindow .. nextWindow + slots - 1, by window number modulo the slot count;
+    // the watermark keeps buffered windows within lateness / granularity + 1 of the newest
+    vector<vector<BufferedPacket>> slots;
+    bool started = false;
+    uint64_t originWindow = 0;
+    uint32_t nextWindow = 0;    // Oldest window not yet released
+    size_t buffered = 0;
+    size_t peak = 0;
+    size_t late = 0;
+    size_t passes = 0;
+
+    // Emits the oldest open window and closes it; the slot keeps its capacity for reuse
+    template <class Emit>
+    void release(Emit& emit) {
+        emitSlot(nextWindow, emit);
+        ++nextWindow;
+    }
+
+    // Capacity bound: emits the oldest buffered packets without closing their window. Windows
+    // before them that hold nothing are closed on the way, including a window passed on early
+    // before: once a later window is emitted, the stages drop packets of earlier ones anyway.
+    template <class Emit>
+    void passOldest(Emit& emit) {
+        ++passes;
+        while (slots[nextWindow % slots.size()].empty()) {
+            ++nextWindow;
+        }
+        emitSlot(nextWindow, emit);
+    }
+
+    template <class Emit>
+    void emitSlot(uint32_t window, Emit& emit) {
+        vector<BufferedPacket>& slot = slots[window % slots.size()];
+        for (const BufferedPacket& packet : slot) {
+            emit(packet.flowID, window);
+        }
+        buffered -= slot.size();
+        slot.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef STEADYSKETCH_H
+#define STEADYSKETCH_H
+using namespace std;
+#include "parm.h"
+#include "stage3.h"
+#include "MurmurHash3.h"
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// SteadySketch comparison baseline: a single-stage steady-flow detector. Every flow that gets a
+// bucket keeps reborn counters (COUNTER_BITS wide, wrapping) for the windows of its current
+// subflow and the running statistics of its current stable period, so the stability check and the
+// merge happen in the bucket itself, with no filter in front and no separate merger behind.
+// It uses the same SUBFLOW_WINDOWS, STABLE_THRESHOLD, P and Q as PlacidSketch and reports through
+// StableFlowReport, so the two are compared on the same terms.
+
+struct SteadyBucket {
+    char ID[KEY_LEN]{};
+    array<uint8_t, SUBFLOW_WINDOWS> counters{};  // Counts of the current subflow's windows
+    uint16_t subflows = 0;                       // Stable subflows merged into the current period
+    uint32_t subflowStart = 0;
+    uint32_t lastWindow = 0;                     // Last window with a packet
+    uint32_t periodStart = 0;
+    float mean = 0.0f;
+    float variance = 0.0f;
+
+    bool empty() const { return ID[0] == 0; }
+};
+
+class SteadySketch {
+public:
+    static constexpr uint32_t ROWS = 2;
+
+    explicit SteadySketch(size_t memoryBytes = STAGE1_2_TOTAL_MEMORY_BYTES + STAGE3_MEMORY_BYTES)
+        : width(max<size_t>(1, memoryBytes / (ROWS * sizeof(SteadyBucket)))), buckets(ROWS * width) {}
+
+    void processPacket(const Packet& packet) {
+        processPacket(packet.flowID, packet.windowNumber);
+    }
+
+    // Packet given by its flow key (KEY_LEN bytes) and window number, as PlacidSketch takes it
+    void processPacket(const char* flowID, uint32_t window) {
+        SteadyBucket* claim = nullptr;
+        for (uint32_t row = 0; row < ROWS; ++row) {
+            uint32_t h;
+            MurmurHash3_x86_32(flowID, KEY_LEN, 0x500 + row, &h);
+            SteadyBucket& bucket = buckets[row * width + h % width];
+            if (!bucket.empty() && memcmp(bucket.ID, flowID, KEY_LEN) == 0) {
+                countPacket(bucket, window);
+                return;
+            }
+            // A bucket whose flow skipped a window holds no subflow in progress and can be taken
+            if (!claim && (bucket.empty() || bucket.lastWindow + 1 < window)) {
+                claim = &bucket;
+            }
+        }
+        if (!claim) {
+            ++dropped;
+            return;
+        }
+        closeFlow(*claim);
+        memcpy(claim->ID, flowID, KEY_LEN);
+        startSubflow(*claim, window);
+    }
+
+    // Close every flow still held: complete subflows are evaluated and open periods reported
+    void finalizeProcessing() {
+        for (auto& bucket : buckets) {
+            closeFlow(bucket);
+        }
+    }
+
+    const vector<StableFlowReport>& stableFlows() const { return reported; }
+
+    // Same interface as PlacidSketch; the baseline keeps every report until drained
+    template <class Consume>
+    void drainStableFlows(Consume&& consume) {
+        for (const StableFlowReport& report : reported) {
+            consume(report);
+        }
+        reported.clear();
+    }
+
+    // Packets of flows that found no bucket
+    size_t droppedPackets() const { return dropped; }
+    size_t bucketsPerRow() const { return width; }
+
+private:
+    void countPacket(SteadyBucket& bucket, uint32_t window) {
+        if (window != bucket.lastWindow) {
+            if (bucket.lastWindow == bucket.subflowStart + SUBFLOW_WINDOWS - 1) {
+                evaluateSubflow(bucket);
+            }
+            if (window != bucket.lastWindow + 1) {
+                reportPeriod(bucket);
+            }
+            if (window != bucket.lastWindow + 1 || window == bucket.subflowStart + SUBFLOW_WINDOWS) {
+                startSubflow(bucket, window);
+                return;
+            }
+            bucket.lastWindow = window;
+        }
+        ++bucket.counters[window - bucket.subflowStart];  // Wraps: a reborn counter
+    }
+
+    void startSubflow(SteadyBucket& bucket, uint32_t window) {
+        bucket.counters.fill(0);
+        bucket.counters[0] = 1;
+        bucket.subflowStart = window;
+        bucket.lastWindow = window;
+    }
+
+    // The bucket's subflow just completed: merge it into the period if it is stable and the pooled
+    // variance stays within the threshold, otherwise end the period (and start one if it is stable)
+    void evaluateSubflow(SteadyBucket& bucket) {
+        constexpr uint32_t half = (1u << COUNTER_BITS) >> 1;
+        float direct[SUBFLOW_WINDOWS], offset[SUBFLOW_WINDOWS];
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < SUBFLOW_WINDOWS; ++i) {
+            direct[i] = bucket.counters[i];
+            offset[i] = static_cast<float>(bucket.counters[i] ^ half);
+            sum += direct[i];
+        }
+        const float mean = sum / SUBFLOW_WINDOWS;
+        const float variance = min(sampleVariance(direct), sampleVariance(offset));
+        if (variance > STABLE_THRESHOLD) {
+            reportPeriod(bucket);
+            return;
+        }
+
+        if (bucket.subflows > 0 && bucket.subflows < P &&
+            bucket.subflowStart == bucket.periodStart + bucket.subflows * SUBFLOW_WINDOWS) {
+            const float c = bucket.subflows;
+            const float mu = (c * bucket.mean + mean) / (c + 1);
+            const float pooled = (c * (bucket.variance + (bucket.mean - mu) * (bucket.mean - mu)) +
+                                  variance + (mean - mu) * (mean - mu)) / (c + 1);
+            if (pooled <= STABLE_THRESHOLD) {
+                bucket.subflows++;
+                bucket.mean = mu;
+                bucket.variance = pooled;
+                return;
+            }
+        }
+        reportPeriod(bucket);
+        bucket.subflows = 1;
+        bucket.periodStart = bucket.subflowStart;
+        bucket.mean = mean;
+        bucket.variance = variance;
+    }
+
+    static float sampleVariance(const float* x) {
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < SUBFLOW_WINDOWS; ++i) sum += x[i];
+        const float mean = sum / SUBFLOW_WINDOWS;
+        float squares = 0.0f;
+        for (uint32_t i = 0; i < SUBFLOW_WINDOWS; ++i) squares += (x[i] - mean) * (x[i] - mean);
+        return squares / (SUBFLOW_WINDOWS - 1);
+    }
+
+    // Report the bucket's period if it reached Q subflows, then drop it
+    void reportPeriod(SteadyBucket& bucket) {
+        if (bucket.subflows >= Q) {
+            StableFlowReport report;
+            memcpy(report.ID, bucket.ID, KEY_LEN);
+            report.startWindow = bucket.periodStart;
+            report.endWindow = bucket.periodStart + bucket.subflows * SUBFLOW_WINDOWS - 1;
+            report.subflows = bucket.subflows;
+            report.mean = bucket.mean;
+            report.variance = bucket.variance;
+            reported.push_back(report);
+        }
+        bucket.subflows = 0;
+    }
+
+    void closeFlow(SteadyBucket& bucket) {
+        if (bucket.empty()) {
+            return;
+        }
+        if (bucket.lastWindow == bucket.subflowStart + SUBFLOW_WINDOWS - 1) {
+            evaluateSubflow(bucket);
+        }
+        reportPeriod(bucket);
+        bucket = SteadyBucket();
+    }
+
+    size_t width;
+    vector<SteadyBucket> buckets;
+    vector<StableFlowReport> reported;
+    size_t dropped = 0;
+};
+
+#endif
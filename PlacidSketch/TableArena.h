@@ -0,0 +1,152 @@
+#ifndef TABLEARENA_H
+#define TABLEARENA_H
+using namespace std;
+#include "parm.h"
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include <sys/mman.h>
+
+// Sketch tables carved from anonymous mappings: 64-byte aligned, on 2 MB huge pages when the kernel
+// has them, and zeroed lazily by the kernel on first touch. Tables whose empty state is all-zero
+// bytes (Stage1 buckets, Stage2 words and cells, Stage3 cells) are never written at construction.
+
+// Array view of a table in an arena; the arena owns the memory
+template <class T>
+struct ArenaSpan {
+    T* first = nullptr;
+    size_t count = 0;
+
+    T& operator[](size_t i) const { return first[i]; }
+    T* data() const { return first; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T* begin() const { return first; }
+    T* end() const { return first + count; }
+};
+
+class TableArena {
+public:
+    static constexpr size_t ALIGNMENT = 64;
+    static constexpr size_t HUGE_PAGE_BYTES = size_t(2) << 20;
+
+    // capacityHint sizes the first mapping; tables that do not fit get further mappings
+    explicit TableArena(size_t capacityHint = 0, bool hugePages = TABLE_ARENA_HUGE_PAGES) : useHugePages(hugePages) {
+        if (capacityHint > 0) {
+            reserve(capacityHint);
+        }
+    }
+
+    TableArena(const TableArena&) = delete;
+    TableArena& operator=(const TableArena&) = delete;
+
+    ~TableArena() {
+        for (const auto& chunk : chunks) {
+            munmap(chunk.base, chunk.bytes);
+        }
+    }
+
+    // Map the first chunk now if nothing is mapped yet
+    void reserve(size_t bytes) {
+        if (chunks.empty()) {
+            mapChunk(bytes);
+        }
+    }
+
+    // count zero-filled elements; T's all-zero bytes must be a valid value
+    template <class T>
+    ArenaSpan<T> allocate(size_t count) {
+        static_assert(is_trivially_destructible<T>::value && alignof(T) <= ALIGNMENT,
+                      "arena tables are never destroyed and are 64-byte aligned");
+        return ArenaSpan<T>{static_cast<T*>(carve(count * sizeof(T))), count};
+    }
+
+    // count copies of value, for tables whose empty state is not all-zero bytes (touches every page)
+    template <class T>
+    ArenaSpan<T> allocate(size_t count, const T& value) {
+        ArenaSpan<T> span = allocate<T>(count);
+        for (auto& element : span) {
+            new (&element) T(value);
+        }
+        return span;
+    }
+
+    size_t mappedBytes() const {
+        size_t total = 0;
+        for (const auto& chunk : chunks) total += chunk.bytes;
+        return total;
+    }
+
+    // Bytes mapped from the explicit huge-page pool; the rest may still get transparent huge pages
+    size_t hugeTlbBytes() const {
+        size_t total = 0;
+        for (const auto& chunk : chunks) total += chunk.hugeTlb ? chunk.bytes : 0;
+        return total;
+    }
+
+    size_t usedBytes() const { return used; }
+    size_t chunkCount() const { return chunks.size(); }
+
+private:
+    struct Chunk {
+        char* base;
+        size_t bytes;
+        size_t offset;
+        bool hugeTlb;
+    };
+
+    vector<Chunk> chunks;
+    size_t used = 0;
+    bool useHugePages;
+
+    void* carve(size_t bytes) {
+        bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        if (chunks.empty() || chunks.back().bytes - chunks.back().offset < bytes) {
+            mapChunk(bytes);
+        }
+        Chunk& chunk = chunks.back();
+        void* p = chunk.base + chunk.offset;
+        chunk.offset += bytes;
+        used += bytes;
+        return p;
+    }
+
+    // Explicit huge pages first, then 4 KB pages on a 2 MB-aligned range with transparent huge pages
+    // requested, so that the kernel can still back it with huge pages. Throws bad_alloc like the
+    // vectors it replaces.
+    void mapChunk(size_t bytes) {
+        bytes = (max<size_t>(bytes, 1) + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+        void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (useHugePages) {
+            p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                chunks.push_back(Chunk{static_cast<char*>(p), bytes, 0, true});
+                return;
+            }
+        }
+#endif
+        const size_t padded = bytes + (useHugePages ? HUGE_PAGE_BYTES : 0);
+        p = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw bad_alloc();
+        }
+        char* base = static_cast<char*>(p);
+        if (useHugePages) {
+            // Trim the padding so that the chunk starts on a huge-page boundary
+            char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(base) + HUGE_PAGE_BYTES - 1) &
+                                                    ~(HUGE_PAGE_BYTES - 1));
+            if (aligned > base) munmap(base, aligned - base);
+            if (aligned + bytes < base + padded) munmap(aligned + bytes, base + padded - (aligned + bytes));
+            base = aligned;
+#ifdef MADV_HUGEPAGE
+            madvise(base, bytes, MADV_HUGEPAGE);
+#endif
+        }
+        chunks.push_back(Chunk{base, bytes, 0, false});
+    }
+};
+
+#endif
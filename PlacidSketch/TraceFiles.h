@@ -0,0 +1,136 @@
+#ifndef TRACEFILES_H
+#define TRACEFILES_H
+using namespace std;
+#include "parm.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Trace directories as main reads them: one CSV file per window, in file-name order.
+// labels.csv (written by tracegen next to the windows) is not a window.
+inline bool listWindowFiles(const string& directory, vector<string>& files) {
+    files.clear();
+    error_code ec;
+    for (const auto& entry : filesystem::directory_iterator(directory, ec)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".csv" && entry.path().filename() != "labels.csv") {
+            files.push_back(entry.path().string());
+        }
+    }
+    sort(files.begin(), files.end());
+    return !ec && !files.empty();
+}
+
+// One window file: quintuple,seq,fingerprint after a header line, parsed as PacketProcessor does
+inline bool readWindowCsv(const string& path, uint32_t window, vector<Packet>& packets) {
+    packets.clear();
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) {
+        return false;
+    }
+    string line;
+    char buffer[1 << 16];
+    bool header = true;
+    auto parse = [&](const string& text) {
+        if (header) {
+            header = false;
+            return;
+        }
+        if (text.empty()) return;
+        string fingerprint, quintuple;
+        size_t first = text.find(',');
+        if (first == string::npos) {
+            fingerprint = text;
+        } else {
+            quintuple = text.substr(0, first);
+            size_t second = text.find(',', first + 1);
+            if (second == string::npos) {
+                fingerprint = text.substr(first + 1);
+            } else {
+                size_t third = text.find(',', second + 1);
+                fingerprint = text.substr(second + 1, third == string::npos ? string::npos : third - second - 1);
+            }
+        }
+        if (!fingerprint.empty()) {
+            packets.emplace_back(fingerprint.c_str(), quintuple.empty() ? nullptr : quintuple.c_str(), window);
+        }
+    };
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            if (buffer[i] == '\n') {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                parse(line);
+                line.clear();
+            } else {
+                line.push_back(buffer[i]);
+            }
+        }
+    }
+    if (!line.empty()) parse(line);
+    bool ok = !ferror(in);
+    fclose(in);
+    return ok;
+}
+
+// Reads the window files in order and hands each to visit(window, packets); returns false at the
+// first file that cannot be read, with its path in failed
+inline bool forEachWindowFile(const vector<string>& files, const function<void(uint32_t, const vector<Packet>&)>& visit,
+                              string& failed) {
+    vector<Packet> packets;
+    for (uint32_t w = 0; w < files.size(); ++w) {
+        if (!readWindowCsv(files[w], w, packets)) {
+            failed = files[w];
+            return false;
+        }
+        visit(w, packets);
+    }
+    return true;
+}
+
+// The whole trace, shared read-only by every sketch: each distinct flow key stored once, and each
+// packet as a 4-byte index into the keys, so a trace costs little more than its packet count
+struct SharedTrace {
+    vector<char> keys;                      // KEY_LEN bytes per flow
+    vector<uint32_t> packets;               // Flow index per packet, in arrival order
+    vector<size_t> windowStart{0};          // Window w is packets[windowStart[w], windowStart[w + 1])
+    unordered_map<string, uint32_t> index;  // Loading only; cleared by seal
+
+    // Windows must arrive in order, starting at 0
+    bool addWindow(uint32_t window, const vector<Packet>& windowPackets) {
+        if (window + 1 != windowStart.size()) {
+            return false;
+        }
+        for (const auto& packet : windowPackets) {
+            auto it = index.emplace(string(packet.flowID, KEY_LEN), static_cast<uint32_t>(index.size())).first;
+            if (it->second == keys.size() / KEY_LEN) {
+                keys.insert(keys.end(), packet.flowID, packet.flowID + KEY_LEN);
+            }
+            packets.push_back(it->second);
+        }
+        windowStart.push_back(packets.size());
+        return true;
+    }
+
+    void seal() { index = unordered_map<string, uint32_t>(); }
+
+    uint32_t windows() const { return static_cast<uint32_t>(windowStart.size() - 1); }
+    size_t flows() const { return keys.size() / KEY_LEN; }
+    size_t bytes() const { return keys.size() + packets.size() * sizeof(uint32_t); }
+    const char* key(uint32_t flow) const { return keys.data() + size_t(flow) * KEY_LEN; }
+
+    // visit(flowID, window) for every packet, in trace order
+    template <class Visitor>
+    void replay(Visitor&& visit) const {
+        for (uint32_t w = 0; w < windows(); ++w) {
+            for (size_t i = windowStart[w]; i < windowStart[w + 1]; ++i) {
+                visit(key(packets[i]), w);
+            }
+        }
+    }
+};
+
+#endif
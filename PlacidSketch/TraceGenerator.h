@@ -0,0 +1,427 @@
+#ifndef TRACEGENERATOR_H
+#define TRACEGENERATOR_H
+using namespace std;
+#include "parm.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Synthetic traces: Zipf-distributed background flows plus planted flows with controlled mean,
+// standard deviation and lifetime. Every window is generated from its own RNG stream derived from
+// the seed, so output is identical for any thread count. Draws use fixed algorithms (mt19937_64,
+// Box-Muller, Fisher-Yates) rather than the <random> distributions, but the Zipf sampler and
+// Box-Muller call exp, log, log1p, expm1 and cos, whose last bit libm does not pin down: a seed
+// reproduces its trace on the same platform and math library, not necessarily across them.
+
+// Planted flow shapes, chosen to drive every Stage2 and Stage3 path
+enum PlantedKind : uint32_t {
+    PLANTED_STEADY = 0,       // Small variance: subflow emission and Stage3 merges; long ones fill a cell (P)
+    PLANTED_WRAPPING = 1,     // Mean above the 8-bit counter range: rebirths and CK updates
+    PLANTED_NOISY = 2,        // Variance around STABLE_THRESHOLD: stability-check rejections
+    PLANTED_INTERMITTENT = 3, // Absent one window in every period: Stage1 resets and Stage3 discontinuities
+    PLANTED_DRIFTING = 4,     // Mean steps every period windows: Stage3 merge rejections
+    PLANTED_KINDS = 5
+};
+
+inline const char* plantedKindName(uint32_t kind) {
+    static const char* const names[PLANTED_KINDS] = {"steady", "wrapping", "noisy", "intermittent", "drifting"};
+    return kind < PLANTED_KINDS ? names[kind] : "unknown";
+}
+
+struct PlantedFlow {
+    uint32_t kind;
+    uint32_t startWindow;
+    uint32_t endWindow;     // Exclusive
+    double mean;
+    double stddev;
+    uint32_t period;        // Intermittent and drifting flows; 0 otherwise
+};
+
+struct TraceConfig {
+    uint64_t seed = 1;
+    uint32_t windows = 100;
+    uint64_t backgroundFlows = 1000000;
+    uint64_t backgroundPacketsPerWindow = 1000000;
+    double zipfSkew = 1.1;
+    uint32_t plantedFlows = 1000;
+    // Share of planted flows per kind, in PlantedKind order
+    double kindShare[PLANTED_KINDS] = {0.5, 0.1, 0.15, 0.15, 0.1};
+    double meanMin = 20.0;
+    double meanMax = 250.0;
+    uint32_t durationMin = 30;
+    uint32_t durationMax = 100;
+};
+
+// Synthetic defaults of evaluate, sweep and autotune: long enough for planted flows to reach Q subflows
+inline TraceConfig evaluationDefaults() {
+    TraceConfig config;
+    config.windows = 400;
+    config.backgroundFlows = 200000;
+    config.backgroundPacketsPerWindow = 200000;
+    config.durationMin = 250;
+    config.durationMax = 400;
+    return config;
+}
+
+// Generator options shared by the tools ("--windows 400"); returns false if arg is not one of them
+inline bool setTraceOption(TraceConfig& config, const string& arg, const char* value) {
+    if (arg == "--seed") config.seed = strtoull(value, nullptr, 0);
+    else if (arg == "--windows") config.windows = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+    else if (arg == "--background-flows") config.backgroundFlows = strtoull(value, nullptr, 0);
+    else if (arg == "--background-packets") config.backgroundPacketsPerWindow = strtoull(value, nullptr, 0);
+    else if (arg == "--zipf") config.zipfSkew = strtod(value, nullptr);
+    else if (arg == "--planted") config.plantedFlows = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+    else if (arg == "--mean-min") config.meanMin = strtod(value, nullptr);
+    else if (arg == "--mean-max") config.meanMax = strtod(value, nullptr);
+    else if (arg == "--duration-min") config.durationMin = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+    else if (arg == "--duration-max") config.durationMax = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+    else return false;
+    return true;
+}
+
+// Clamps planted lifetimes to the trace; returns false for a configuration that cannot be generated
+inline bool validTraceConfig(TraceConfig& config) {
+    if (config.windows == 0 || config.durationMin == 0 || config.durationMin > config.durationMax) {
+        return false;
+    }
+    config.durationMax = min(config.durationMax, config.windows);
+    config.durationMin = min(config.durationMin, config.durationMax);
+    return true;
+}
+
+// Rejection-inversion sampler for Zipf(n, s) (Hormann and Derflinger), O(1) time and memory
+class ZipfSampler {
+public:
+    ZipfSampler(uint64_t n, double s) : n(static_cast<double>(n)), exponent(s) {
+        hIntegralX1 = hIntegral(1.5) - 1.0;
+        hIntegralN = hIntegral(this->n + 0.5);
+        squeeze = 2.0 - hIntegralInverse(hIntegral(2.5) - h(2.0));
+    }
+
+    // Rank in [1, n]; unit() draws uniform doubles in [0, 1)
+    template <class Unit>
+    uint64_t sample(Unit&& unit) const {
+        while (true) {
+            const double u = hIntegralN + unit() * (hIntegralX1 - hIntegralN);
+            const double x = hIntegralInverse(u);
+            double k = floor(x + 0.5);
+            k = k < 1.0 ? 1.0 : (k > n ? n : k);
+            if (k - x <= squeeze || u >= hIntegral(k + 0.5) - h(k)) {
+                return static_cast<uint64_t>(k);
+            }
+        }
+    }
+
+private:
+    double n;
+    double exponent;
+    double hIntegralX1 = 0.0;
+    double hIntegralN = 0.0;
+    double squeeze = 0.0;
+
+    double h(double x) const { return exp(-exponent * log(x)); }
+
+    double hIntegral(double x) const {
+        const double logX = log(x);
+        return helper2((1.0 - exponent) * logX) * logX;
+    }
+
+    double hIntegralInverse(double x) const {
+        double t = x * (1.0 - exponent);
+        if (t < -1.0) t = -1.0;
+        return exp(helper1(t) * x);
+    }
+
+    static double helper1(double x) {
+        return fabs(x) > 1e-8 ? log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+    }
+
+    static double helper2(double x) {
+        return fabs(x) > 1e-8 ? expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+    }
+};
+
+class TraceGenerator {
+public:
+    // Flow tokens: planted flows have the top bit set, the rest is the flow index (background: Zipf rank - 1)
+    static constexpr uint64_t PLANTED_BIT = 1ull << 63;
+
+    explicit TraceGenerator(const TraceConfig& cfg) : config(cfg), zipf(max<uint64_t>(1, cfg.backgroundFlows), cfg.zipfSkew) {
+        Random rng(mix(config.seed, ~0ull));
+        double cumulative[PLANTED_KINDS];
+        double total = 0.0;
+        for (uint32_t k = 0; k < PLANTED_KINDS; ++k) {
+            total += config.kindShare[k];
+            cumulative[k] = total;
+        }
+        planted.reserve(config.plantedFlows);
+        for (uint32_t f = 0; f < config.plantedFlows; ++f) {
+            PlantedFlow flow{};
+            const double pick = rng.unit() * total;
+            flow.kind = PLANTED_KINDS - 1;
+            for (uint32_t k = 0; k < PLANTED_KINDS; ++k) {
+                if (pick < cumulative[k]) {
+                    flow.kind = k;
+                    break;
+                }
+            }
+            const uint32_t duration = min(config.windows, config.durationMin +
+                                          static_cast<uint32_t>(rng.below(config.durationMax - config.durationMin + 1)));
+            flow.startWindow = static_cast<uint32_t>(rng.below(config.windows - duration + 1));
+            flow.endWindow = flow.startWindow + duration;
+            flow.mean = config.meanMin + rng.unit() * (config.meanMax - config.meanMin);
+            flow.stddev = rng.unit();
+            switch (flow.kind) {
+                case PLANTED_WRAPPING:
+                    flow.mean = 300.0 + rng.unit() * 1700.0;
+                    break;
+                case PLANTED_NOISY:
+                    flow.stddev = 1.5 + rng.unit() * 3.0;  // Variance 2.25 .. 20.25 around STABLE_THRESHOLD
+                    break;
+                case PLANTED_INTERMITTENT:
+                    flow.period = 3 + static_cast<uint32_t>(rng.below(2 * SUBFLOW_WINDOWS));
+                    break;
+                case PLANTED_DRIFTING:
+                    flow.period = SUBFLOW_WINDOWS + static_cast<uint32_t>(rng.below(4 * SUBFLOW_WINDOWS));
+                    break;
+                default:
+                    break;
+            }
+            planted.push_back(flow);
+        }
+    }
+
+    const TraceConfig& configuration() const { return config; }
+    const vector<PlantedFlow>& plantedFlows() const { return planted; }
+
+    // Flow key as Stage1-3 see it: NUL-padded to KEY_LEN
+    static void flowKey(uint64_t token, char* key) {
+        memset(key, 0, KEY_LEN);
+        // Prefix plus 14 hex digits: 56 bits of flow index fill the 15 usable key bytes
+        static const char digits[] = "0123456789abcdef";
+        uint64_t index = token & ((1ull << 56) - 1);
+        key[0] = (token & PLANTED_BIT) ? 'p' : 'b';
+        for (int i = KEY_LEN - 2; i >= 1; --i) {
+            key[i] = digits[index & 15];
+            index >>= 4;
+        }
+    }
+
+    // "10.a.b.c:sport-192.168.d.e:dport-proto", derived from the token (snprintf is the bottleneck at scale)
+    static void flowQuintuple(uint64_t token, char* quintuple) {
+        const uint64_t h = mix(token, 0x5157);
+        char* p = quintuple;
+        appendText(p, "10.");
+        appendDecimal(p, unsigned(h >> 56));
+        *p++ = '.';
+        appendDecimal(p, unsigned((h >> 48) & 255));
+        *p++ = '.';
+        appendDecimal(p, unsigned((h >> 40) & 255));
+        *p++ = ':';
+        appendDecimal(p, unsigned((h >> 24) & 65535));
+        appendText(p, "-192.168.");
+        appendDecimal(p, unsigned((h >> 16) & 255));
+        *p++ = '.';
+        appendDecimal(p, unsigned((h >> 8) & 255));
+        *p++ = ':';
+        appendDecimal(p, unsigned(h & 1023) + 1024);
+        appendText(p, (h & 1) ? "-6" : "-17");
+        *p = 0;
+    }
+
+    // Planted packets of a flow in a window; 0 when absent
+    static uint32_t plantedCount(const PlantedFlow& flow, uint32_t window, double gaussian) {
+        if (window < flow.startWindow || window >= flow.endWindow) {
+            return 0;
+        }
+        const uint32_t age = window - flow.startWindow;
+        double mean = flow.mean;
+        if (flow.kind == PLANTED_INTERMITTENT && age % flow.period == flow.period - 1) {
+            return 0;
+        }
+        if (flow.kind == PLANTED_DRIFTING && (age / flow.period) % 2 == 1) {
+            mean *= 1.5;
+        }
+        const double count = floor(mean + flow.stddev * gaussian + 0.5);
+        return count < 1.0 ? 1u : static_cast<uint32_t>(count);
+    }
+
+    // Flow tokens of every packet in a window, in arrival order
+    void windowTokens(uint32_t window, vector<uint64_t>& tokens) const {
+        Random rng(mix(config.seed, window));
+        tokens.clear();
+        for (uint64_t i = 0; i < config.backgroundPacketsPerWindow && config.backgroundFlows > 0; ++i) {
+            tokens.push_back(zipf.sample([&] { return rng.unit(); }) - 1);
+        }
+        for (uint32_t f = 0; f < planted.size(); ++f) {
+            const double gaussian = rng.gaussian();
+            const uint32_t count = plantedCount(planted[f], window, gaussian);
+            tokens.insert(tokens.end(), count, PLANTED_BIT | f);
+        }
+        // Fisher-Yates with the window's own stream
+        for (size_t i = tokens.size(); i > 1; --i) {
+            swap(tokens[i - 1], tokens[rng.below(i)]);
+        }
+    }
+
+    // In-memory form: the packets of one window
+    void windowPackets(uint32_t window, vector<Packet>& packets) const {
+        vector<uint64_t> tokens;
+        windowTokens(window, tokens);
+        packets.clear();
+        packets.reserve(tokens.size());
+        char key[KEY_LEN];
+        char quintuple[KEY_LEN1];
+        for (uint64_t token : tokens) {
+            flowKey(token, key);
+            flowQuintuple(token, quintuple);
+            packets.emplace_back(key, quintuple, window);
+        }
+    }
+
+    // Generates windows on `threads` threads and hands them to visit(window, packets) in window order,
+    // holding at most `threads` windows in memory
+    void forEachWindow(unsigned threads, const function<void(uint32_t, const vector<Packet>&)>& visit) const {
+        threads = max(1u, threads);
+        vector<vector<Packet>> batch(threads);
+        for (uint32_t first = 0; first < config.windows; first += threads) {
+            const uint32_t count = min<uint32_t>(threads, config.windows - first);
+            runParallel(count, [&](uint32_t i) { windowPackets(first + i, batch[i]); });
+            for (uint32_t i = 0; i < count; ++i) {
+                visit(first + i, batch[i]);
+            }
+        }
+    }
+
+    // CSV form read by PacketProcessor: one file per window (quintuple,seq,fingerprint with a header),
+    // named so that sorting by name gives window order. Returns false on the first write error.
+    bool writeCsv(const string& directory, unsigned threads) const {
+        atomic<uint32_t> next(0);
+        atomic<bool> ok(true);
+        runParallel(max(1u, threads), [&](uint32_t) {
+            vector<uint64_t> tokens;
+            string buffer;
+            char key[KEY_LEN];
+            char quintuple[KEY_LEN1];
+            char line[KEY_LEN1 + KEY_LEN + 32];
+            for (uint32_t w = next++; w < config.windows && ok; w = next++) {
+                windowTokens(w, tokens);
+                char name[64];
+                snprintf(name, sizeof(name), "/window_%08u.csv", w);
+                FILE* out = fopen((directory + name).c_str(), "wb");
+                if (!out) {
+                    ok = false;
+                    return;
+                }
+                buffer = "quintuple,seq,fingerprint\n";
+                for (size_t i = 0; i < tokens.size(); ++i) {
+                    flowKey(tokens[i], key);
+                    flowQuintuple(tokens[i], quintuple);
+                    char* p = line;
+                    appendText(p, quintuple);
+                    *p++ = ',';
+                    appendDecimal(p, i);
+                    *p++ = ',';
+                    appendText(p, key);
+                    *p++ = '\n';
+                    buffer.append(line, static_cast<size_t>(p - line));
+                    if (buffer.size() >= (1u << 20)) {
+                        ok = ok && fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+                        buffer.clear();
+                    }
+                }
+                ok = ok && fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+                ok = (fclose(out) == 0) && ok;
+            }
+        });
+        return ok;
+    }
+
+    // Ground-truth label file: one row per planted flow with the parameters it was generated from
+    bool writeLabels(const string& path) const {
+        FILE* out = fopen(path.c_str(), "wb");
+        if (!out) {
+            return false;
+        }
+        fprintf(out, "fingerprint,kind,start_window,end_window,mean,stddev,period\n");
+        char key[KEY_LEN];
+        for (uint32_t f = 0; f < planted.size(); ++f) {
+            const PlantedFlow& flow = planted[f];
+            flowKey(PLANTED_BIT | f, key);
+            fprintf(out, "%s,%s,%u,%u,%.3f,%.3f,%u\n", key, plantedKindName(flow.kind), flow.startWindow,
+                    flow.endWindow, flow.mean, flow.stddev, flow.period);
+        }
+        return fclose(out) == 0;
+    }
+
+private:
+    // mt19937_64 plus the fixed-algorithm draws built on it
+    struct Random {
+        mt19937_64 engine;
+        explicit Random(uint64_t seed) : engine(seed) {}
+
+        double unit() { return static_cast<double>(engine() >> 11) * (1.0 / 9007199254740992.0); }
+
+        // Uniform in [0, bound) by multiply-shift; bias below 2^-64 * bound
+        uint64_t below(uint64_t bound) {
+            return static_cast<uint64_t>((static_cast<unsigned __int128>(engine()) * bound) >> 64);
+        }
+
+        // Box-Muller; one draw per call keeps each flow's stream position fixed
+        double gaussian() {
+            const double u1 = 1.0 - unit();
+            const double u2 = unit();
+            return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+        }
+    };
+
+    static void appendText(char*& p, const char* text) {
+        while (*text) *p++ = *text++;
+    }
+
+    static void appendDecimal(char*& p, uint64_t value) {
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value);
+        while (n) *p++ = digits[--n];
+    }
+
+    // splitmix64 of (seed, stream): independent per-window streams
+    static uint64_t mix(uint64_t seed, uint64_t stream) {
+        uint64_t z = seed + 0x9e3779b97f4a7c15ull * (stream + 1);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    template <class Body>
+    static void runParallel(uint32_t count, Body&& body) {
+        vector<thread> workers;
+        for (uint32_t i = 1; i < count; ++i) {
+            workers.emplace_back([&body, i] { body(i); });
+        }
+        if (count > 0) {
+            body(0);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    TraceConfig config;
+    ZipfSampler zipf;
+    vector<PlantedFlow> planted;
+};
+
+#endif
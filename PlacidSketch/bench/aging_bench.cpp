@@ -0,0 +1,123 @@
+// Stage2 idle-bucket aging on churny traffic: detection with and without aging, and the live / aged
+// bucket counts sampled by the aging sweep. Background flows live a few windows and never return,
+// so their buckets go idle; a planted flow counts as detected when Stage3 holds a cell for it.
+// Also checks window jumps: after a gap longer than SUBFLOW_WINDOWS every bucket is dead, and the
+// sweep must empty the table even when the gap is 16 windows or more and the epoch tags alias.
+#include "parm.h"
+#include "stage2.h"
+#include "stage3.h"
+#include "promoted_trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t WINDOWS = 100;
+constexpr int STABLE_FLOWS = 1500;
+constexpr int CHURN_PER_WINDOW = 1500;
+constexpr uint32_t CHURN_LIFETIME = 3;
+
+static void flowName(char* id, char kind, uint32_t window, int flow) {
+    promotedFlowKey(id, "%c%03u%05d", kind, window, flow);
+}
+
+static vector<PromotedPacket> buildTrace() {
+    mt19937 gen(5);
+    vector<int> means(STABLE_FLOWS);
+    for (int f = 0; f < STABLE_FLOWS; ++f) means[f] = 10 + static_cast<int>(gen() % 300);
+
+    return buildPromotedTrace(WINDOWS, gen, [&](uint32_t w, auto add) {
+        char flowID[KEY_LEN];
+        for (int f = 0; f < STABLE_FLOWS; ++f) {
+            flowName(flowID, 's', 0, f);
+            add(flowID, means[f] + uniform_int_distribution<int>(-2, 2)(gen));
+        }
+        // Each generation of short-lived flows is born in window b and gone after b + CHURN_LIFETIME - 1
+        for (uint32_t b = w + 1 > CHURN_LIFETIME ? w + 1 - CHURN_LIFETIME : 0; b <= w; ++b) {
+            for (int f = 0; f < CHURN_PER_WINDOW; ++f) {
+                flowName(flowID, 'c', b, f);
+                add(flowID, 5 + static_cast<int>(gen() % 40));
+            }
+        }
+    });
+}
+
+struct Result {
+    double detection;
+    size_t falsePositives;
+    size_t lazilyAged;
+    Stage2AgingSample sample;
+};
+
+// Returns the last window fed
+static uint32_t feed(Stage2Monitor<>& stage2, const vector<PromotedPacket>& trace) {
+    uint32_t window = 0;
+    for (const auto& p : trace) {
+        if (p.window != window) {
+            stage2.closeWindow(window, p.window);
+            window = p.window;
+        }
+        stage2.processPotentialFlow(p.flowID, p.window);
+    }
+    return window;
+}
+
+static Result run(const vector<PromotedPacket>& trace, size_t stage2Bytes, bool aging) {
+    Stage3Merger stage3(STAGE3_RNG_SEED);
+    Stage2Monitor stage2(stage3, stage2Bytes, STAGE2_DELTA_ENCODING, STAGE2_DEFERRED_EVALUATION, aging);
+    feed(stage2, trace);
+
+    size_t stable = 0, churn = 0;
+    for (size_t u = 0; u < stage3.bucketCount(); ++u) {
+        for (size_t i = 0; i < stage3.cellsPerBucket(); ++i) {
+            const Stage3Cell& cell = stage3.cellAt(u, i);
+            if (cell.empty()) continue;
+            (cell.ID[0] == 's' ? stable : churn)++;
+        }
+    }
+    return Result{100.0 * stable / STABLE_FLOWS, churn, stage2.lazilyAgedBuckets(), stage2.agingSample()};
+}
+
+int main() {
+    vector<PromotedPacket> trace = buildTrace();
+    printf("%zu promoted packets, %d stable flows, %d new flows per window living %u windows, %u windows\n\n",
+           trace.size(), STABLE_FLOWS, CHURN_PER_WINDOW, CHURN_LIFETIME, WINDOWS);
+    printf("%8s | %9s %6s | %9s %6s %9s | %22s\n", "bytes", "detect%", "fp", "detect%", "fp", "lazy-aged",
+           "last slice live/aged");
+    for (size_t kb : {8, 16, 32, 64, 128}) {
+        size_t bytes = kb * 1024;
+        Result off = run(trace, bytes, false);
+        Result on = run(trace, bytes, true);
+        printf("%7zuK | %9.1f %6zu | %9.1f %6zu %9zu | %10zu / %-10zu\n", kb, off.detection, off.falsePositives,
+               on.detection, on.falsePositives, on.lazilyAged, on.sample.live, on.sample.aged);
+    }
+
+    // Window jumps, as with idle links or a reorder buffer that skips empty windows
+    printf("\n%8s | %14s %14s\n", "gap", "occupied before", "left after");
+    bool clean = true;
+    for (uint32_t gap : {STAGE2_AGING_SWEEP_PERIOD, 11u, 16u, 17u, 32u, 100u}) {
+        Stage3Merger stage3(STAGE3_RNG_SEED);
+        Stage2Monitor stage2(stage3, 32 * 1024, STAGE2_DELTA_ENCODING, STAGE2_DEFERRED_EVALUATION, true);
+        const uint32_t last = feed(stage2, trace);
+        auto occupied = [&] {
+            size_t n = 0;
+            for (size_t r = 0; r < STAGE2_ROWS; ++r) {
+                for (size_t i = 0; i < stage2.width(); ++i) n += !stage2.bucketAt(r, i).empty();
+            }
+            return n;
+        };
+        const size_t before = occupied();
+        stage2.closeWindow(last, last + gap);
+        const size_t after = occupied();
+        clean = clean && after == 0;
+        printf("%8u | %14zu %14zu\n", gap, before, after);
+    }
+    if (!clean) {
+        printf("FAIL: dead buckets survived a window jump\n");
+        return 1;
+    }
+    printf("OK: every jump past SUBFLOW_WINDOWS empties the table\n");
+    return 0;
+}
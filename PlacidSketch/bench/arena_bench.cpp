@@ -0,0 +1,93 @@
+// Table arena at large budgets: construction time and Stage1 + Stage2 per-packet cost with the tables
+// on huge pages (explicit, or transparent when the kernel grants them) versus 4 KB pages, next to
+// the value-initialized vectors the stages used before. The first pass over the keys takes the page
+// faults of lazily zeroed tables; the second pass shows the steady-state TLB cost.
+#include "parm.h"
+#include "stage1.h"
+#include "stage2.h"
+#include "stage3.h"
+#include "TableArena.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t PACKETS = 4000000;
+
+// Keys spread over far more flows than any table holds, so every probe lands on a random line
+static vector<array<char, KEY_LEN>> buildKeys() {
+    mt19937_64 gen(5);
+    vector<array<char, KEY_LEN>> keys(PACKETS);
+    for (auto& key : keys) {
+        key.fill(0);
+        snprintf(key.data(), KEY_LEN, "k%014llx", (unsigned long long)(gen() >> 8));
+    }
+    return keys;
+}
+
+// Anonymous memory the kernel currently backs with transparent huge pages, in MB (Linux only)
+static double anonHugeMb() {
+    FILE* in = fopen("/proc/self/smaps_rollup", "r");
+    if (!in) return -1.0;
+    char line[256];
+    double kb = -1.0;
+    while (fgets(line, sizeof(line), in)) {
+        if (strncmp(line, "AnonHugePages:", 14) == 0) kb = strtod(line + 14, nullptr);
+    }
+    fclose(in);
+    return kb < 0 ? kb : kb / 1024.0;
+}
+
+static double pass(Stage1Filter<>& stage1, Stage2Monitor<>& stage2, const vector<array<char, KEY_LEN>>& keys,
+                   uint32_t window) {
+    auto start = chrono::steady_clock::now();
+    for (const auto& key : keys) {
+        stage1.processPacket(key.data(), window);
+        stage2.processPotentialFlow(key.data(), window);
+    }
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / keys.size();
+}
+
+static void run(const char* name, size_t totalMb, bool hugePages, const vector<array<char, KEY_LEN>>& keys) {
+    const size_t total = totalMb << 20;
+    const size_t stage3Bytes = total / 4;
+    const size_t stage1Bytes = static_cast<size_t>((total - stage3Bytes) * STAGE1_MEMORY_RATIO);
+    const size_t stage2Bytes = total - stage3Bytes - stage1Bytes;
+
+    auto start = chrono::steady_clock::now();
+    TableArena tables(total + TABLE_ARENA_EXTRA_BYTES, hugePages);
+    Stage3Merger<> stage3(STAGE3_RNG_SEED, stage3Bytes, STAGE3_TOP_K, &tables);
+    Stage1Filter<> stage1(stage1Bytes, STAGE1_PROMOTED_CACHE_ENTRIES, STAGE1_PACKED_BUCKETS, &tables);
+    Stage2Monitor<> stage2(stage3, stage2Bytes, STAGE2_DELTA_ENCODING, STAGE2_DEFERRED_EVALUATION, STAGE2_AGING,
+                           STAGE2_PREAGGREGATION, &tables);
+    const double constructMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    const double first = pass(stage1, stage2, keys, 0);
+    const double second = pass(stage1, stage2, keys, 0);
+    printf("%-10s %6zu MB  construct %8.2f ms  first pass %7.1f ns/pkt  second pass %7.1f ns/pkt  "
+           "hugetlb %5zu MB  THP %7.1f MB\n",
+           name, totalMb, constructMs, first, second, tables.hugeTlbBytes() >> 20, anonHugeMb());
+}
+
+// What the nested vectors cost to build: every byte value-initialized at construction
+static void vectorBaseline(size_t totalMb) {
+    auto start = chrono::steady_clock::now();
+    vector<vector<uint64_t>> rows(4, vector<uint64_t>((totalMb << 20) / 4 / sizeof(uint64_t)));
+    const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    printf("%-10s %6zu MB  construct %8.2f ms  (value-initialized vectors, for reference)\n", "vectors", totalMb, ms);
+}
+
+int main() {
+    const vector<array<char, KEY_LEN>> keys = buildKeys();
+    printf("%zu packets of distinct random flows per pass, Stage1 + Stage2 on every packet\n", keys.size());
+    for (size_t mb : {16, 64, 256}) {
+        vectorBaseline(mb);
+        run("4 KB", mb, false, keys);
+        run("huge", mb, true, keys);
+    }
+    return 0;
+}
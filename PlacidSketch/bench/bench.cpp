@@ -0,0 +1,199 @@
+// Micro-benchmarks for each stage and the hash kernel: ns/op, Mops/s and cycles/op.
+// Every case builds its state from fixed seeds outside the timed loop and reports the median of
+// REPEATS runs. Cycles come from the hardware counter when perf_event_open is allowed and from
+// the TSC otherwise (marked "tsc").
+#include "parm.h"
+#include "stage1.h"
+#include "stage2.h"
+#include "stage3.h"
+#include "latency.h"
+#include "MurmurHash3.h"
+#include "perf_counters.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr int REPEATS = 5;
+constexpr size_t KEYS = 1 << 16;
+
+struct Sample {
+    double ns;
+    double cycles;
+};
+
+static PerfCounters perf;
+
+// Time body() over ops operations after setup(); neither setup nor teardown is timed
+static void report(const char* name, size_t ops, const function<void()>& setup, const function<void()>& body) {
+    vector<Sample> samples;
+    for (int r = 0; r < REPEATS; ++r) {
+        setup();
+        perf.start();
+        const uint64_t tsc = readCycleCounter();
+        auto start = chrono::steady_clock::now();
+        body();
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        const uint64_t ticks = readCycleCounter() - tsc;
+        perf.stop();
+        const double cycles = perf.available(PerfCounters::CYCLES) ? perf.value(PerfCounters::CYCLES) : ticks;
+        samples.push_back(Sample{seconds * 1e9 / ops, cycles / ops});
+    }
+    sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) { return a.ns < b.ns; });
+    const Sample& median = samples[REPEATS / 2];
+    printf("%-40s %9.2f ns/op %9.2f Mops/s %9.1f %s/op\n", name, median.ns, 1e3 / median.ns, median.cycles,
+           perf.available(PerfCounters::CYCLES) ? "cycles" : "tsc");
+}
+
+static vector<array<char, KEY_LEN>> makeKeys(char prefix, size_t n) {
+    vector<array<char, KEY_LEN>> keys(n);
+    for (size_t i = 0; i < n; ++i) {
+        keys[i].fill(0);
+        snprintf(keys[i].data(), KEY_LEN, "%c%09zu", prefix, i);
+    }
+    return keys;
+}
+
+static volatile uint32_t sink;
+
+static void benchMurmur() {
+    auto keys = makeKeys('k', KEYS);
+    report("MurmurHash3_x86_32 16-byte key", KEYS, [] {}, [&] {
+        uint32_t acc = 0;
+        for (const auto& key : keys) {
+            uint32_t h;
+            MurmurHash3_x86_32(key.data(), KEY_LEN, 0x100, &h);
+            acc += h;
+        }
+        sink = acc;
+    });
+}
+
+static void benchStage1() {
+    auto keys = makeKeys('f', KEYS);
+    unique_ptr<Stage1Filter<>> stage1;
+
+    // First packet of each flow in a fresh filter
+    report("Stage1 processPacket, new flow", KEYS, [&] { stage1.reset(new Stage1Filter<>()); }, [&] {
+        for (const auto& key : keys) sink = stage1->processPacket(key.data(), 0);
+    });
+    // Later packets of flows already seen in this window
+    report("Stage1 processPacket, continuing flow", KEYS,
+           [&] {
+               stage1.reset(new Stage1Filter<>());
+               for (const auto& key : keys) stage1->processPacket(key.data(), 0);
+           },
+           [&] {
+               for (const auto& key : keys) sink = stage1->processPacket(key.data(), 0);
+           });
+    // Flows present for 16 windows, so promoted; a small working set as for heavy flows
+    const size_t heavy = 256;
+    const uint32_t window = 16;
+    report("Stage1 processPacket, promoted flow", heavy * 64,
+           [&] {
+               stage1.reset(new Stage1Filter<>());
+               for (uint32_t w = 0; w <= window; ++w) {
+                   if (w > 0) stage1->resetBuckets(w - 1);
+                   for (size_t i = 0; i < heavy; ++i) stage1->processPacket(keys[i].data(), w);
+               }
+           },
+           [&] {
+               for (int r = 0; r < 64; ++r) {
+                   for (size_t i = 0; i < heavy; ++i) sink = stage1->processPacket(keys[i].data(), window);
+               }
+           });
+}
+
+static void benchStage2() {
+    auto keys = makeKeys('f', KEYS);
+    unique_ptr<Stage3Merger<>> stage3;
+    unique_ptr<Stage2Monitor<>> stage2;
+    auto fresh = [&] {
+        stage3.reset(new Stage3Merger<>());
+        stage2.reset(new Stage2Monitor<>(*stage3));
+    };
+
+    report("Stage2 processPotentialFlow, empty bucket", KEYS, fresh, [&] {
+        for (const auto& key : keys) stage2->processPotentialFlow(key.data(), 0);
+    });
+    report("Stage2 processPotentialFlow, increment", KEYS,
+           [&] {
+               fresh();
+               for (const auto& key : keys) stage2->processPotentialFlow(key.data(), 0);
+           },
+           [&] {
+               for (const auto& key : keys) stage2->processPotentialFlow(key.data(), 0);
+           });
+    // First packet of window 3 after windows 0..2 with the same rate: stability check, no emission
+    report("Stage2 processPotentialFlow, window open", KEYS,
+           [&] {
+               fresh();
+               for (uint32_t w = 0; w < 3; ++w) {
+                   if (w > 0) stage2->closeWindow(w - 1, w);
+                   for (int r = 0; r < 20; ++r) {
+                       for (const auto& key : keys) stage2->processPotentialFlow(key.data(), w);
+                   }
+               }
+               stage2->closeWindow(2, 3);
+           },
+           [&] {
+               for (const auto& key : keys) stage2->processPotentialFlow(key.data(), 3);
+           });
+    // First packet of window SUBFLOW_WINDOWS: a complete stable subflow goes to Stage3
+    report("Stage2 processPotentialFlow, subflow emit", KEYS,
+           [&] {
+               fresh();
+               for (uint32_t w = 0; w < SUBFLOW_WINDOWS; ++w) {
+                   if (w > 0) stage2->closeWindow(w - 1, w);
+                   for (int r = 0; r < 20; ++r) {
+                       for (const auto& key : keys) stage2->processPotentialFlow(key.data(), w);
+                   }
+               }
+               stage2->closeWindow(SUBFLOW_WINDOWS - 1, SUBFLOW_WINDOWS);
+           },
+           [&] {
+               for (const auto& key : keys) stage2->processPotentialFlow(key.data(), SUBFLOW_WINDOWS);
+           });
+}
+
+static void benchStage3() {
+    auto keys = makeKeys('f', KEYS);
+    unique_ptr<Stage3Merger<>> stage3;
+    const size_t capacity = Stage3Merger<>().bucketCount() * Stage3Merger<>().cellsPerBucket();
+    const size_t ops = 4096;
+
+    for (double occupancy : {0.0, 0.5, 1.0}) {
+        // Distinct flows land in random buckets, so twice the capacity is needed to fill every cell
+        const size_t resident = min(KEYS - ops, static_cast<size_t>(capacity * (occupancy < 1.0 ? occupancy : 2.0)));
+        char name[64];
+        snprintf(name, sizeof(name), "Stage3 processSteadySubflow, %3.0f%% full", occupancy * 100);
+        // Time subflows of flows that have no cell yet
+        report(name, ops,
+               [&] {
+                   stage3.reset(new Stage3Merger<>());
+                   for (size_t i = 0; i < resident; ++i) {
+                       stage3->processSteadySubflow(keys[i].data(), 0, 1.0f, 100.0f);
+                   }
+               },
+               [&] {
+                   for (size_t i = 0; i < ops; ++i) {
+                       stage3->processSteadySubflow(keys[KEYS - 1 - i].data(), 10, 1.0f, 100.0f);
+                   }
+               });
+    }
+}
+
+int main() {
+    printf("repeats %d, median reported; Stage3 RNG seed %u\n\n", REPEATS, STAGE3_RNG_SEED);
+    benchMurmur();
+    benchStage1();
+    benchStage2();
+    benchStage3();
+    return 0;
+}
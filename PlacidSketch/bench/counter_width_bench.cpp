@@ -0,0 +1,96 @@
+// Stage2 counter width: the same Stage2 budget with 4-, 8-, 12- and 16-bit counters on steady flows
+// of very different rates. Narrow counters wrap (rebirth) many times per window on heavy flows, and
+// a window with more than two rebirths fails checkStability; wider counters cost bucket size instead.
+// Reports the per-packet cost, rebirths, and the share of each rate tier that reaches Stage3.
+#define PLACID_STATS 1
+#define PLACID_STATS_DUMP(window) ((void)0)
+#include "parm.h"
+#include "stage2.h"
+#include "stage3.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+template <int Bits>
+struct CounterConfig : DefaultConfig {
+    static constexpr int COUNTER_BITS = Bits;
+};
+
+constexpr uint32_t WINDOWS = 30;
+constexpr int FLOWS_PER_TIER = 50;
+constexpr array<int, 4> TIER_RATES = {10, 100, 1000, 5000};
+constexpr size_t STAGE2_BYTES = 64 * 1024;
+
+struct Trace {
+    vector<array<char, KEY_LEN>> keys;  // Flow f is in tier f / FLOWS_PER_TIER
+    vector<uint32_t> packets;           // Flow index per packet
+    vector<size_t> windowStart;         // First packet of each window, plus the end
+};
+
+static Trace buildTrace() {
+    mt19937 gen(47);
+    Trace trace;
+    trace.keys.resize(TIER_RATES.size() * FLOWS_PER_TIER);
+    for (size_t f = 0; f < trace.keys.size(); ++f) {
+        trace.keys[f].fill(0);
+        snprintf(trace.keys[f].data(), KEY_LEN, "t%d-%05d", int(f / FLOWS_PER_TIER), int(f % FLOWS_PER_TIER));
+    }
+    for (uint32_t w = 0; w < WINDOWS; ++w) {
+        trace.windowStart.push_back(trace.packets.size());
+        for (uint32_t f = 0; f < trace.keys.size(); ++f) {
+            const int count = TIER_RATES[f / FLOWS_PER_TIER] + uniform_int_distribution<int>(-2, 2)(gen);
+            trace.packets.insert(trace.packets.end(), count, f);
+        }
+        shuffle(trace.packets.begin() + trace.windowStart.back(), trace.packets.end(), gen);
+    }
+    trace.windowStart.push_back(trace.packets.size());
+    return trace;
+}
+
+template <int Bits>
+static void run(const Trace& trace) {
+    using Config = CounterConfig<Bits>;
+    placidStats() = PlacidStats();
+    Stage3Merger<Config> stage3(STAGE3_RNG_SEED);
+    Stage2Monitor<Config> stage2(stage3, STAGE2_BYTES);
+
+    auto start = chrono::steady_clock::now();
+    for (uint32_t w = 0; w < WINDOWS; ++w) {
+        if (w > 0) stage2.closeWindow(w - 1, w);
+        for (size_t i = trace.windowStart[w]; i < trace.windowStart[w + 1]; ++i) {
+            stage2.processPotentialFlow(trace.keys[trace.packets[i]].data(), w);
+        }
+    }
+    const double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / trace.packets.size();
+
+    array<int, TIER_RATES.size()> detected{};
+    for (size_t u = 0; u < stage3.bucketCount(); ++u) {
+        for (size_t i = 0; i < stage3.cellsPerBucket(); ++i) {
+            const Stage3Cell& cell = stage3.cellAt(u, i);
+            if (!cell.empty() && cell.ID[0] == 't') ++detected[cell.ID[1] - '0'];
+        }
+    }
+    printf("%5d %7zu B %9zu %8.2f %10llu", Bits, sizeof(Stage2Bucket<Config>), stage2.width() * STAGE2_ROWS, ns,
+           (unsigned long long)placidStats().stage2.rebirths);
+    for (int d : detected) printf(" %8.1f%%", 100.0 * d / FLOWS_PER_TIER);
+    printf("\n");
+}
+
+int main() {
+    const Trace trace = buildTrace();
+    printf("%zu promoted packets over %u windows, %d steady flows per rate tier, %zu KB of Stage2\n\n",
+           trace.packets.size(), WINDOWS, FLOWS_PER_TIER, STAGE2_BYTES / 1024);
+    printf("%5s %9s %9s %8s %10s", "bits", "bucket", "buckets", "ns/pkt", "rebirths");
+    for (int rate : TIER_RATES) printf(" %6d/w", rate);
+    printf("\n");
+    run<4>(trace);
+    run<8>(trace);
+    run<12>(trace);
+    run<16>(trace);
+    return 0;
+}
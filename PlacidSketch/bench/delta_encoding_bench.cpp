@@ -0,0 +1,165 @@
+// Stage2 wide (8-byte) buckets vs. delta-encoded (5-byte) cells: detection rate versus memory.
+// Planted stable flows and unstable background flows are fed to Stage2 as promoted packets; a planted
+// flow counts as detected when Stage3 holds a cell for it at the end of the trace.
+// 1) Differential check: at equal width and with an escape pool that never overflows, delta cells
+//    must decode to the wide buckets' words after every window, with identical Stage3 cells.
+// 2) Detection, false positives and cost at equal memory.
+#include "parm.h"
+#include "stage2.h"
+#include "stage3.h"
+#include "promoted_trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t WINDOWS = 100;
+constexpr int STABLE_FLOWS = 1500;
+constexpr int BACKGROUND_FLOWS = 6000;
+// Few enough unstable flows that their escapes fit the pool of the differential check
+constexpr int DIFFERENTIAL_BACKGROUND_FLOWS = 200;
+
+static void flowName(char* id, int flow) {
+    promotedFlowKey(id, "%c%07d", flow < STABLE_FLOWS ? 's' : 'b', flow);
+}
+
+static vector<PromotedPacket> buildTrace(int backgroundFlows) {
+    mt19937 gen(99);
+    vector<int> means(STABLE_FLOWS);
+    for (int f = 0; f < STABLE_FLOWS; ++f) means[f] = 10 + static_cast<int>(gen() % 300);
+
+    return buildPromotedTrace(WINDOWS, gen, [&](uint32_t, auto add) {
+        char flowID[KEY_LEN];
+        for (int f = 0; f < STABLE_FLOWS + backgroundFlows; ++f) {
+            int count;
+            if (f < STABLE_FLOWS) {
+                count = means[f] + uniform_int_distribution<int>(-2, 2)(gen);
+            } else if (f % 2) {
+                count = uniform_int_distribution<int>(0, 60)(gen);       // Bursty
+            } else {
+                count = (gen() % 4 == 0) ? 0 : 5 + static_cast<int>(gen() % 30);  // Intermittent
+            }
+            flowName(flowID, f);
+            add(flowID, count);
+        }
+    });
+}
+
+static bool sameStage3(const Stage3Merger<>& a, const Stage3Merger<>& b) {
+    for (size_t u = 0; u < a.bucketCount(); ++u) {
+        for (size_t i = 0; i < a.cellsPerBucket(); ++i) {
+            if (memcmp(&a.cellAt(u, i), &b.cellAt(u, i), sizeof(Stage3Cell)) != 0) return false;
+        }
+    }
+    return true;
+}
+
+// Smallest delta budget whose rows hold width buckets, or 0 when no budget gives exactly that many
+static size_t deltaBytesForWidth(size_t width) {
+    Stage3Merger stage3(STAGE3_RNG_SEED);
+    size_t low = 1, high = width * STAGE2_ROWS * sizeof(uint64_t);
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        if (Stage2Monitor(stage3, mid, true).width() < width) low = mid + 1;
+        else high = mid;
+    }
+    return Stage2Monitor(stage3, low, true).width() == width ? low : 0;
+}
+
+static bool differentialCheck(const vector<PromotedPacket>& trace, size_t wideBytes) {
+    Stage3Merger wide3(STAGE3_RNG_SEED), delta3(STAGE3_RNG_SEED);
+    Stage2Monitor wide(wide3, wideBytes, false);
+    const size_t deltaBytes = deltaBytesForWidth(wide.width());
+    if (deltaBytes == 0) {
+        printf("FAIL: no delta budget gives %zu buckets per row\n", wide.width());
+        return false;
+    }
+    Stage2Monitor delta(delta3, deltaBytes, true);
+    size_t peakEscaped = 0;
+    size_t i = 0;
+    for (uint32_t w = 0; w < WINDOWS; ++w) {
+        if (w > 0) {
+            wide.closeWindow(w - 1, w);
+            delta.closeWindow(w - 1, w);
+        }
+        for (; i < trace.size() && trace[i].window == w; ++i) {
+            wide.processPotentialFlow(trace[i].flowID, w);
+            delta.processPotentialFlow(trace[i].flowID, w);
+        }
+        peakEscaped = max(peakEscaped, delta.escapedBuckets());
+        if (delta.escapePoolOverflows() != 0) {
+            printf("FAIL: the escape pool overflowed in window %u; the differential needs a pool that never does\n", w);
+            return false;
+        }
+        for (size_t r = 0; r < STAGE2_ROWS; ++r) {
+            for (size_t b = 0; b < wide.width(); ++b) {
+                if (wide.bucketAt(r, b).word != delta.bucketAt(r, b).word) {
+                    printf("FAIL: delta cell (%zu, %zu) differs from the wide bucket after window %u\n", r, b, w);
+                    return false;
+                }
+            }
+        }
+        if (!sameStage3(wide3, delta3)) {
+            printf("FAIL: Stage3 differs between wide and delta Stage2 after window %u\n", w);
+            return false;
+        }
+    }
+    printf("differential: %zu packets over %u windows, %zu buckets per row in %zu wide / %zu delta bytes, "
+           "up to %zu escaped, identical state after every window\n\n",
+           trace.size(), WINDOWS, wide.width(), wideBytes, deltaBytes, peakEscaped);
+    return true;
+}
+
+struct Result {
+    size_t width;
+    double detection;
+    double falsePositives;
+    double nsPerPacket;
+    size_t escaped;
+    size_t overflows;
+};
+
+static Result run(const vector<PromotedPacket>& trace, size_t stage2Bytes, bool delta) {
+    Stage3Merger stage3(STAGE3_RNG_SEED);
+    Stage2Monitor stage2(stage3, stage2Bytes, delta);
+
+    auto start = chrono::steady_clock::now();
+    for (const auto& p : trace) {
+        stage2.processPotentialFlow(p.flowID, p.window);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t stable = 0, background = 0;
+    for (size_t u = 0; u < stage3.bucketCount(); ++u) {
+        for (size_t i = 0; i < stage3.cellsPerBucket(); ++i) {
+            const Stage3Cell& cell = stage3.cellAt(u, i);
+            if (cell.empty()) continue;
+            (cell.ID[0] == 's' ? stable : background)++;
+        }
+    }
+    return Result{stage2.width(), 100.0 * stable / STABLE_FLOWS, 100.0 * background / BACKGROUND_FLOWS,
+                  seconds * 1e9 / trace.size(), stage2.escapedBuckets(), stage2.escapePoolOverflows()};
+}
+
+int main() {
+    if (!differentialCheck(buildTrace(DIFFERENTIAL_BACKGROUND_FLOWS), 128 * 1024)) {
+        return 1;
+    }
+    vector<PromotedPacket> trace = buildTrace(BACKGROUND_FLOWS);
+    printf("%zu promoted packets, %d stable flows, %d background flows, %u windows\n\n",
+           trace.size(), STABLE_FLOWS, BACKGROUND_FLOWS, WINDOWS);
+    printf("%8s | %9s %9s %8s %7s | %9s %9s %8s %7s %8s %9s\n", "bytes", "wide/row", "detect%", "fp%", "ns/pkt",
+           "delta/row", "detect%", "fp%", "ns/pkt", "escaped", "overflow");
+    for (size_t kb : {8, 16, 32, 64, 128}) {
+        size_t bytes = kb * 1024;
+        Result wide = run(trace, bytes, false);
+        Result delta = run(trace, bytes, true);
+        printf("%7zuK | %9zu %9.1f %8.1f %7.1f | %9zu %9.1f %8.1f %7.1f %8zu %9zu\n", kb,
+               wide.width, wide.detection, wide.falsePositives, wide.nsPerPacket,
+               delta.width, delta.detection, delta.falsePositives, delta.nsPerPacket, delta.escaped, delta.overflows);
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Concurrent point queries: one thread ingests a trace while another keeps asking queryFlow about the
+// planted steady flows. Reports the ingest thread's CPU time alone and with the reader running (CPU
+// time, so the comparison holds on a single core), the cost per query, and how many answers already
+// call a flow stable before finalizeProcessing. Every answer must be a state the flow's cell actually
+// passes through, taken from a sequential run of the same trace: a torn read of a cell being
+// rewritten would mix fields of two states.
+#include "parm.h"
+#include "PlacidSketch.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <time.h>
+
+using namespace std;
+
+constexpr uint32_t WINDOWS = 220;
+constexpr uint32_t STEADY_FLOWS = 400;
+constexpr uint32_t BACKGROUND_POOL = 100000;
+constexpr uint32_t BACKGROUND_PER_WINDOW = 10000;
+
+// Packets per window of steady flow f
+static uint32_t rateOf(uint32_t f) { return 10 + (f * 7) % 120; }
+
+struct Trace {
+    vector<array<char, KEY_LEN>> keys;
+    vector<uint32_t> packets;    // Flow index per packet
+    vector<size_t> windowStart;  // First packet of each window, plus the end
+};
+
+static Trace buildTrace() {
+    mt19937 gen(49);
+    Trace trace;
+    trace.keys.resize(STEADY_FLOWS + BACKGROUND_POOL);
+    for (size_t f = 0; f < trace.keys.size(); ++f) {
+        trace.keys[f].fill(0);
+        snprintf(trace.keys[f].data(), KEY_LEN, "f%08u", static_cast<uint32_t>(f));
+    }
+    for (uint32_t w = 0; w < WINDOWS; ++w) {
+        trace.windowStart.push_back(trace.packets.size());
+        for (uint32_t f = 0; f < STEADY_FLOWS; ++f) {
+            trace.packets.insert(trace.packets.end(), rateOf(f) + gen() % 3 - 1, f);
+        }
+        for (uint32_t i = 0; i < BACKGROUND_PER_WINDOW; ++i) {
+            trace.packets.push_back(STEADY_FLOWS + gen() % BACKGROUND_POOL);
+        }
+        shuffle(trace.packets.begin() + trace.windowStart.back(), trace.packets.end(), gen);
+    }
+    trace.windowStart.push_back(trace.packets.size());
+    return trace;
+}
+
+static double threadCpuSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the ingest thread's CPU seconds; afterWindow(w) runs once window w's packets are in
+template <class AfterWindow>
+static double ingest(PlacidSketch<>& sketch, const Trace& trace, AfterWindow afterWindow) {
+    const double start = threadCpuSeconds();
+    for (uint32_t w = 0; w < WINDOWS; ++w) {
+        for (size_t i = trace.windowStart[w]; i < trace.windowStart[w + 1]; ++i) {
+            sketch.processPacket(trace.keys[trace.packets[i]].data(), w);
+        }
+        afterWindow(w);
+    }
+    return threadCpuSeconds() - start;
+}
+
+// A tracked flow's answer, with the statistics compared bit for bit
+using CellState = tuple<uint32_t, uint32_t, uint32_t, uint32_t, uint32_t>;
+
+static CellState stateOf(uint32_t f, const FlowStability& answer) {
+    uint32_t mean, variance;
+    memcpy(&mean, &answer.mean, sizeof(mean));
+    memcpy(&variance, &answer.variance, sizeof(variance));
+    return CellState(f, answer.startWindow, answer.subflows, mean, variance);
+}
+
+int main() {
+    const Trace trace = buildTrace();
+    printf("%zu packets over %u windows, %u steady flows queried\n\n", trace.packets.size(), WINDOWS, STEADY_FLOWS);
+
+    // A steady flow's cell changes at most once per window (its subflow arrives with its first packet
+    // of the next window), so the states seen between windows are every state a query can return
+    PlacidSketch<> alone;
+    vector<CellState> states;
+    const double aloneSeconds = ingest(alone, trace, [&](uint32_t) {
+        for (uint32_t f = 0; f < STEADY_FLOWS; ++f) {
+            const FlowStability answer = alone.queryFlow(trace.keys[f].data());
+            if (answer.tracked) states.push_back(stateOf(f, answer));
+        }
+    });
+    sort(states.begin(), states.end());
+    const double queryStart = threadCpuSeconds();
+    size_t timedQueries = 0;
+    for (int round = 0; round < 1000; ++round) {
+        for (uint32_t f = 0; f < STEADY_FLOWS; ++f, ++timedQueries) {
+            alone.queryFlow(trace.keys[f].data());
+        }
+    }
+    const double queryUs = (threadCpuSeconds() - queryStart) * 1e6 / timedQueries;
+
+    PlacidSketch<> sketch;
+    atomic<bool> done(false);
+    size_t queries = 0, tracked = 0, stable = 0, invalid = 0;
+    thread reader([&] {
+        for (uint32_t f = 0; !done.load(memory_order_relaxed); f = (f + 1) % STEADY_FLOWS) {
+            const FlowStability answer = sketch.queryFlow(trace.keys[f].data());
+            ++queries;
+            if (!answer.tracked) continue;
+            ++tracked;
+            stable += answer.stable;
+            invalid += !binary_search(states.begin(), states.end(), stateOf(f, answer));
+        }
+    });
+    const double ingestSeconds = ingest(sketch, trace, [](uint32_t) {});
+    done = true;
+    reader.join();
+
+    size_t stableAtEnd = 0;
+    for (uint32_t f = 0; f < STEADY_FLOWS; ++f) {
+        stableAtEnd += sketch.queryFlow(trace.keys[f].data()).stable;
+    }
+    sketch.finalizeProcessing();
+
+    printf("ingest alone          %7.3f s CPU  %6.2f Mpps (including %zu snapshot queries)\n", aloneSeconds,
+           trace.packets.size() / aloneSeconds / 1e6, size_t(WINDOWS) * STEADY_FLOWS);
+    printf("ingest with reader    %7.3f s CPU  %6.2f Mpps\n", ingestSeconds, trace.packets.size() / ingestSeconds / 1e6);
+    printf("query                 %.2f us CPU each on an idle sketch\n", queryUs);
+    printf("reader                %zu queries, %zu tracked, %zu stable, %zu not a state of the flow's cell\n", queries,
+           tracked, stable, invalid);
+    printf("before finalize       %zu of %u steady flows stable; %zu reported after finalize\n", stableAtEnd,
+           STEADY_FLOWS, sketch.stableFlows().size());
+    if (invalid != 0) {
+        printf("FAIL: a query returned a torn cell\n");
+        return 1;
+    }
+    printf("OK: every answer is a state of the flow's cell\n");
+    return 0;
+}
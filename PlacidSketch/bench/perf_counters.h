@@ -0,0 +1,79 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+// Hardware counters for benchmarks via perf_event_open (Linux only).
+// available() is false when the kernel or platform does not allow it; callers print "n/a".
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class PerfCounters {
+public:
+    enum Event { CYCLES = 0, INSTRUCTIONS, BRANCHES, BRANCH_MISSES, EVENT_COUNT };
+
+    PerfCounters() {
+#if defined(__linux__)
+        const uint64_t configs[EVENT_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                               PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < EVENT_COUNT; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available(Event e) const { return fds[e] >= 0; }
+
+    void start() {
+#if defined(__linux__)
+        for (int fd : fds) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void stop() {
+#if defined(__linux__)
+        for (int i = 0; i < EVENT_COUNT; ++i) {
+            values[i] = 0;
+            if (fds[i] < 0) continue;
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t v = 0;
+            if (read(fds[i], &v, sizeof(v)) == sizeof(v)) values[i] = v;
+        }
+#endif
+    }
+
+    uint64_t value(Event e) const { return values[e]; }
+
+private:
+    int fds[EVENT_COUNT] = {-1, -1, -1, -1};
+    uint64_t values[EVENT_COUNT] = {};
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef PROMOTED_TRACE_H
+#define PROMOTED_TRACE_H
+// Promoted-packet traces for the Stage2 benches: the packets Stage1 hands on, as a flow key and a window.
+// A bench describes its traffic window by window as (flow key, packet count) pairs; buildPromotedTrace()
+// lays out the packets and shuffles each window with the bench's generator, which the bench may also
+// draw from for its per-window counts.
+#include "parm.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct PromotedPacket {
+    char flowID[KEY_LEN];
+    uint32_t window;
+};
+
+// printf-style flow key, NUL-padded to KEY_LEN
+template <class... Args>
+inline void promotedFlowKey(char* flowID, const char* format, Args... args) {
+    memset(flowID, 0, KEY_LEN);
+    snprintf(flowID, KEY_LEN, format, args...);
+}
+
+// flows(window, add) calls add(flowID, count) once per flow with packets in that window
+template <class Flows>
+std::vector<PromotedPacket> buildPromotedTrace(uint32_t windows, std::mt19937& gen, Flows flows) {
+    std::vector<PromotedPacket> trace;
+    PromotedPacket p{};
+    for (uint32_t w = 0; w < windows; ++w) {
+        size_t first = trace.size();
+        p.window = w;
+        flows(w, [&](const char* flowID, int count) {
+            memcpy(p.flowID, flowID, KEY_LEN);
+            if (count > 0) trace.insert(trace.end(), static_cast<size_t>(count), p);
+        });
+        std::shuffle(trace.begin() + first, trace.end(), gen);
+    }
+    return trace;
+}
+
+#endif
@@ -0,0 +1,129 @@
+// Stage1 packed buckets: at the same memory budget, byte-per-bucket rows against the 6-bit continuity
+// and flag planes, which hold a third more buckets. Reports the false-promotion rate (flow-windows
+// promoted although the flow has not been seen in 15 consecutive windows, caused by bucket sharing),
+// the recall of truly continuous flow-windows, and the per-packet cost. Also checks that the word-level
+// reset of the planes leaves no bucket that a per-bucket reset would have cleared.
+#include "parm.h"
+#include "stage1.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t WINDOWS = 40;
+constexpr uint32_t PERSISTENT_FLOWS = 1000;
+constexpr uint32_t CHURN_POOL = 300000;
+constexpr uint32_t CHURN_PER_WINDOW = 30000;
+constexpr uint32_t CONTINUITY = 15;
+
+struct TracePacket {
+    uint32_t flow;
+    uint32_t window;
+};
+
+// Persistent flows in every window, and churn flows drawn at random from a pool each window, so that
+// a churn flow rarely appears in 15 consecutive windows on its own
+static vector<TracePacket> buildTrace() {
+    mt19937 gen(46);
+    vector<TracePacket> packets;
+    for (uint32_t w = 0; w < WINDOWS; ++w) {
+        size_t first = packets.size();
+        for (uint32_t f = 0; f < PERSISTENT_FLOWS; ++f) {
+            for (uint32_t i = 0; i < 1 + f % 3; ++i) packets.push_back({f, w});
+        }
+        for (uint32_t m = 0; m < CHURN_PER_WINDOW; ++m) {
+            const uint32_t flow = PERSISTENT_FLOWS + gen() % CHURN_POOL;
+            for (uint32_t i = 0; i < 1 + gen() % 2; ++i) packets.push_back({flow, w});
+        }
+        shuffle(packets.begin() + first, packets.end(), gen);
+    }
+    return packets;
+}
+
+struct PackingResult {
+    size_t width = 0;
+    double ns = 0.0;
+    double falsePromotionRate = 0.0;
+    double recall = 0.0;
+    bool resetClean = true;
+};
+
+// No bucket may keep the other window's arrival bit after a reset unless it is empty
+static bool resetIsClean(const Stage1Filter<>& stage1, uint32_t window) {
+    for (size_t row = 0; row < STAGE1_ROWS; ++row) {
+        for (size_t i = 0; i < stage1.width(); ++i) {
+            Stage1Bucket b = stage1.bucketAt(row, i);
+            if (!b.empty() && b.arrival != window % 2) return false;
+        }
+    }
+    return true;
+}
+
+static PackingResult run(const vector<TracePacket>& packets, const vector<array<char, KEY_LEN>>& keys,
+                         size_t memoryBytes, bool packed, bool checkResets) {
+    Stage1Filter<> stage1(memoryBytes, 0, packed);
+    PackingResult result;
+    result.width = stage1.width();
+
+    // Per flow: last window seen, consecutive windows up to it, and the last window it was promoted in
+    vector<uint32_t> lastWindow(keys.size(), UINT32_MAX), run(keys.size(), 0), promotedWindow(keys.size(), UINT32_MAX);
+    size_t continuousPairs = 0, otherPairs = 0, truePromotions = 0, falsePromotions = 0;
+    uint32_t currentWindow = 0;
+    double seconds = 0.0;
+    for (const TracePacket& p : packets) {
+        if (p.window != currentWindow) {
+            auto start = chrono::steady_clock::now();
+            stage1.resetBuckets(currentWindow);
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (checkResets) result.resetClean = result.resetClean && resetIsClean(stage1, currentWindow);
+            currentWindow = p.window;
+        }
+        if (lastWindow[p.flow] != p.window) {
+            run[p.flow] = (lastWindow[p.flow] + 1 == p.window) ? run[p.flow] + 1 : 1;
+            lastWindow[p.flow] = p.window;
+            (run[p.flow] >= CONTINUITY ? continuousPairs : otherPairs)++;
+        }
+        auto start = chrono::steady_clock::now();
+        const bool promoted = stage1.processPacket(keys[p.flow].data(), p.window);
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (promoted && promotedWindow[p.flow] != p.window) {
+            promotedWindow[p.flow] = p.window;
+            (run[p.flow] >= CONTINUITY ? truePromotions : falsePromotions)++;
+        }
+    }
+    result.ns = seconds * 1e9 / packets.size();
+    result.falsePromotionRate = otherPairs ? static_cast<double>(falsePromotions) / otherPairs : 0.0;
+    result.recall = continuousPairs ? static_cast<double>(truePromotions) / continuousPairs : 0.0;
+    return result;
+}
+
+int main() {
+    const vector<TracePacket> packets = buildTrace();
+    vector<array<char, KEY_LEN>> keys(PERSISTENT_FLOWS + CHURN_POOL);
+    for (size_t f = 0; f < keys.size(); ++f) {
+        keys[f].fill(0);
+        snprintf(keys[f].data(), KEY_LEN, "f%08zu", f);
+    }
+    printf("%zu packets over %u windows: %u persistent flows, %u of %u churn flows per window\n", packets.size(),
+           WINDOWS, PERSISTENT_FLOWS, CHURN_PER_WINDOW, CHURN_POOL);
+    printf("%8s %8s %10s %8s %16s %8s\n", "memory", "storage", "buckets", "ns/pkt", "false promotion", "recall");
+
+    bool clean = true;
+    for (size_t kb : {16, 32, 50, 100}) {
+        for (bool packed : {false, true}) {
+            PackingResult r = run(packets, keys, kb * 1024, packed, kb == 16);
+            clean = clean && r.resetClean;
+            printf("%5zu KB %8s %10zu %8.2f %15.4f%% %8.4f\n", kb, packed ? "packed" : "byte", r.width * STAGE1_ROWS,
+                   r.ns, 100.0 * r.falsePromotionRate, r.recall);
+        }
+    }
+    if (!clean) {
+        printf("FAIL: a packed reset left a stale bucket\n");
+        return 1;
+    }
+    printf("OK: packed resets clear every stale bucket\n");
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Stage2 null-bucket transitions: table-driven state machine vs. the reference if/else ladder.
+// 1) Differential check: both run the same promoted-packet stream and must end every window with
+//    identical Stage2 bucket words and identical Stage3 cells.
+// 2) Branch behaviour: branch misses, branches and instructions per packet from hardware counters.
+#include "parm.h"
+#include "stage2.h"
+#include "stage3.h"
+#include "perf_counters.h"
+#include "promoted_trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t WINDOWS = 120;
+constexpr int FLOWS = 3000;
+constexpr size_t STAGE2_BYTES = 32 * 1024;  // Small enough to force collisions and resets
+
+// Mixed traffic: stable, jittered, on/off, wrapping (>255 per window), sporadic and random flows
+static vector<PromotedPacket> buildTrace() {
+    mt19937 gen(2024);
+    return buildPromotedTrace(WINDOWS, gen, [&](uint32_t w, auto add) {
+        char flowID[KEY_LEN];
+        for (int f = 0; f < FLOWS; ++f) {
+            int base = 5 + (f * 37) % 120;
+            int count = 0;
+            switch (f % 6) {
+                case 0: count = base + uniform_int_distribution<int>(-2, 2)(gen); break;
+                case 1: count = base + uniform_int_distribution<int>(-15, 15)(gen); break;
+                case 2: count = ((w / (3 + f % 5)) % 2) ? base : 0; break;
+                case 3: count = 250 + uniform_int_distribution<int>(0, 12)(gen); break;
+                case 4: count = (gen() % 3 == 0) ? 0 : 20 + static_cast<int>(gen() % 3); break;
+                default: count = uniform_int_distribution<int>(0, 40)(gen); break;
+            }
+            promotedFlowKey(flowID, "f%06d", f);
+            add(flowID, count);
+        }
+    });
+}
+
+static bool sameStage2(const Stage2Monitor<>& a, const Stage2Monitor<>& b) {
+    for (size_t r = 0; r < STAGE2_ROWS; ++r) {
+        for (size_t i = 0; i < a.width(); ++i) {
+            if (a.bucketAt(r, i).word != b.bucketAt(r, i).word) return false;
+        }
+    }
+    return true;
+}
+
+static bool sameStage3(const Stage3Merger<>& a, const Stage3Merger<>& b) {
+    for (size_t u = 0; u < a.bucketCount(); ++u) {
+        for (size_t i = 0; i < a.cellsPerBucket(); ++i) {
+            if (memcmp(&a.cellAt(u, i), &b.cellAt(u, i), sizeof(Stage3Cell)) != 0) return false;
+        }
+    }
+    return true;
+}
+
+static bool differentialCheck(const vector<PromotedPacket>& trace) {
+    Stage3Merger ladder3(STAGE3_RNG_SEED), table3(STAGE3_RNG_SEED);
+    Stage2Monitor ladder(ladder3, STAGE2_BYTES), table(table3, STAGE2_BYTES);
+    size_t i = 0;
+    for (uint32_t w = 0; w < WINDOWS; ++w) {
+        for (; i < trace.size() && trace[i].window == w; ++i) {
+            ladder.processPotentialFlow<false>(trace[i].flowID, w);
+            table.processPotentialFlow<true>(trace[i].flowID, w);
+        }
+        if (!sameStage2(ladder, table) || !sameStage3(ladder3, table3)) {
+            printf("FAIL: table-driven Stage2 diverges from the ladder in window %u\n", w);
+            return false;
+        }
+    }
+    printf("differential: %zu packets over %u windows, identical state after every window\n", trace.size(), WINDOWS);
+    return true;
+}
+
+template <bool TableDriven>
+static void measure(const char* name, const vector<PromotedPacket>& trace) {
+    Stage3Merger<> stage3(STAGE3_RNG_SEED);
+    Stage2Monitor<> stage2(stage3, STAGE2_BYTES);
+    PerfCounters counters;
+
+    auto start = chrono::steady_clock::now();
+    counters.start();
+    for (const auto& p : trace) {
+        stage2.processPotentialFlow<TableDriven>(p.flowID, p.window);
+    }
+    counters.stop();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    double n = static_cast<double>(trace.size());
+    printf("%-8s %8.2f ns/pkt", name, seconds * 1e9 / n);
+    const PerfCounters::Event events[] = {PerfCounters::BRANCH_MISSES, PerfCounters::BRANCHES, PerfCounters::INSTRUCTIONS};
+    const char* labels[] = {"branch-misses/pkt", "branches/pkt", "instructions/pkt"};
+    for (int e = 0; e < 3; ++e) {
+        if (counters.available(events[e])) {
+            printf("  %s %.3f", labels[e], counters.value(events[e]) / n);
+        } else {
+            printf("  %s n/a", labels[e]);
+        }
+    }
+    printf("\n");
+}
+
+int main() {
+    vector<PromotedPacket> trace = buildTrace();
+    if (!differentialCheck(trace)) {
+        return 1;
+    }
+    measure<false>("ladder", trace);
+    measure<true>("table", trace);
+    return 0;
+}
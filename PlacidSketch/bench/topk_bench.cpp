@@ -0,0 +1,121 @@
+// Top-k queries over Stage3: two mergers fed the same stream of stable subflows, one keeping the
+// longest / steadiest rankings as its cells change and one answering by scanning every cell. After
+// each subflow period both are asked for the current top 100 in both orders, as an operator polling
+// once a second would. Reports the per-subflow ingest cost with and without the rankings and the cost
+// of a query either way, and checks that the two mergers always give the same answers.
+#include "parm.h"
+#include "stage3.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t PERIODS = 300;  // Subflow periods of MIN_SUBFLOWS windows
+constexpr uint32_t FLOWS = 16000;  // Four times the Stage3 cells left beside the rankings
+constexpr uint32_t ACTIVE_SHARE = 4;  // One flow in ACTIVE_SHARE sends a subflow in a given period
+constexpr size_t TOP_K = 100;
+
+struct Subflow {
+    uint32_t flow;
+    uint32_t startWindow;
+    float variance;
+    float mean;
+};
+
+// Flows alternate between runs of consecutive subflows and gaps; most subflows would merge, some
+// are too noisy to merge, and one flow in ten has runs of up to 400 subflows
+static vector<vector<Subflow>> buildStream() {
+    mt19937 gen(50);
+    vector<uint32_t> runLeft(FLOWS, 0);
+    vector<float> rate(FLOWS);
+    for (uint32_t f = 0; f < FLOWS; ++f) rate[f] = 5.0f + gen() % 200;
+    vector<vector<Subflow>> periods(PERIODS);
+    for (uint32_t p = 0; p < PERIODS; ++p) {
+        for (uint32_t f = 0; f < FLOWS; ++f) {
+            if (runLeft[f] == 0) {
+                if (gen() % ACTIVE_SHARE != 0) continue;
+                runLeft[f] = 1 + gen() % (f % 10 == 0 ? 400 : 40);
+            }
+            --runLeft[f];
+            const float variance = (gen() % 50 == 0) ? 8.0f : uniform_real_distribution<float>(0.0f, 4.0f)(gen);
+            periods[p].push_back({f, p * MIN_SUBFLOWS, variance, rate[f] + uniform_real_distribution<float>(-1, 1)(gen)});
+        }
+        shuffle(periods[p].begin(), periods[p].end(), gen);
+    }
+    return periods;
+}
+
+static bool sameTop(const vector<StableFlowReport>& a, const vector<StableFlowReport>& b) {
+    return a.size() == b.size() && equal(a.begin(), a.end(), b.begin(), [](const auto& x, const auto& y) {
+        return memcmp(x.ID, y.ID, KEY_LEN) == 0 && x.startWindow == y.startWindow && x.subflows == y.subflows &&
+               memcmp(&x.variance, &y.variance, sizeof(float)) == 0;
+    });
+}
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+    const vector<vector<Subflow>> periods = buildStream();
+    vector<array<char, KEY_LEN>> keys(FLOWS);
+    for (size_t f = 0; f < keys.size(); ++f) {
+        keys[f].fill(0);
+        snprintf(keys[f].data(), KEY_LEN, "f%08zu", f);
+    }
+    // The rankings come out of the Stage3 budget; the scanning merger gets the same cells without them
+    Stage3Merger<> ranked(STAGE3_RNG_SEED, STAGE3_MEMORY_BYTES, true);
+    Stage3Merger<> scanned(STAGE3_RNG_SEED, ranked.bucketCount() * ranked.cellsPerBucket() * sizeof(Stage3Cell), false);
+    size_t subflows = 0;
+    for (const auto& period : periods) subflows += period.size();
+    printf("%zu subflows of %u flows over %u periods, %zu Stage3 cells, top %zu every period\n\n", subflows, FLOWS,
+           PERIODS, ranked.bucketCount() * ranked.cellsPerBucket(), TOP_K);
+
+    double ingestRanked = 0, ingestScanned = 0, queryRanked = 0, queryScanned = 0;
+    size_t queries = 0, mismatches = 0, longestAtEnd = 0;
+    for (const auto& period : periods) {
+        auto start = chrono::steady_clock::now();
+        for (const Subflow& s : period) {
+            ranked.processSteadySubflow(keys[s.flow].data(), s.startWindow, s.variance, s.mean);
+        }
+        ingestRanked += secondsSince(start);
+        start = chrono::steady_clock::now();
+        for (const Subflow& s : period) {
+            scanned.processSteadySubflow(keys[s.flow].data(), s.startWindow, s.variance, s.mean);
+        }
+        ingestScanned += secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        const vector<StableFlowReport> longest = ranked.topLongest(TOP_K);
+        const vector<StableFlowReport> steadiest = ranked.topSteadiest(TOP_K);
+        queryRanked += secondsSince(start);
+        start = chrono::steady_clock::now();
+        const vector<StableFlowReport> longestScan = scanned.topLongest(TOP_K);
+        const vector<StableFlowReport> steadiestScan = scanned.topSteadiest(TOP_K);
+        queryScanned += secondsSince(start);
+
+        queries += 2;
+        mismatches += !sameTop(longest, longestScan) + !sameTop(steadiest, steadiestScan);
+        longestAtEnd = longest.empty() ? 0 : longest.front().subflows;
+    }
+
+    printf("%-10s %16s %16s\n", "", "ns/subflow", "us/query");
+    printf("%-10s %16.1f %16.2f\n", "rankings", ingestRanked * 1e9 / subflows, queryRanked * 1e6 / queries);
+    printf("%-10s %16.1f %16.2f\n", "scan", ingestScanned * 1e9 / subflows, queryScanned * 1e6 / queries);
+    printf("longest tracked flow at the end: %zu subflows (%zu windows)\n", longestAtEnd,
+           longestAtEnd * MIN_SUBFLOWS);
+
+    // The rankings must empty with the cells
+    ranked.finalize();
+    const bool emptied = ranked.topLongest(TOP_K).empty() && ranked.topSteadiest(TOP_K).empty();
+    if (mismatches != 0 || !emptied) {
+        printf("FAIL: %zu of %zu top-k answers differ from a scan%s\n", mismatches, queries,
+               emptied ? "" : ", rankings not empty after finalize");
+        return 1;
+    }
+    printf("OK: all %zu top-k answers match a scan of every cell\n", queries);
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Stage2 per-packet latency across a window: inline evaluation vs. deferred window-close sweep.
+// Reports latency percentiles for the first tenth of each window's packets (where inline evaluation
+// runs checkStability, variance and Stage3) and for the rest, plus the cost of the close sweep.
+// Then checks on a small, colliding table that deferred evaluation leaves every bucket as inline
+// evaluation does at the end of each window, when flows share a bucket in one row only.
+#include "parm.h"
+#include "stage2.h"
+#include "stage3.h"
+#include "promoted_trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t WINDOWS = 60;
+constexpr int FLOWS = 4000;
+constexpr size_t STAGE2_BYTES = 1024 * 1024;
+// Collision check: a quarter as many buckets per row as flows
+constexpr int COLLISION_FLOWS = 1024;
+constexpr size_t COLLISION_STAGE2_BYTES = 4096;
+
+static vector<PromotedPacket> buildTrace(int flows, int baseCount) {
+    mt19937 gen(11);
+    return buildPromotedTrace(WINDOWS, gen, [&](uint32_t, auto add) {
+        char flowID[KEY_LEN];
+        for (int f = 0; f < flows; ++f) {
+            promotedFlowKey(flowID, "f%07d", f);
+            add(flowID, baseCount + (f % 200) + uniform_int_distribution<int>(-1, 1)(gen));
+        }
+    });
+}
+
+static double percentile(vector<double>& v, double q) {
+    if (v.empty()) return 0.0;
+    size_t k = min(v.size() - 1, static_cast<size_t>(q * v.size()));
+    nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+static void run(const char* name, const vector<PromotedPacket>& trace, bool deferred) {
+    Stage3Merger stage3(STAGE3_RNG_SEED);
+    Stage2Monitor stage2(stage3, STAGE2_BYTES, STAGE2_DELTA_ENCODING, deferred);
+    vector<double> head, tail;
+    double sweepNs = 0.0;
+
+    size_t i = 0;
+    for (uint32_t w = 0; w < WINDOWS; ++w) {
+        size_t begin = i;
+        while (i < trace.size() && trace[i].window == w) ++i;
+        size_t headEnd = begin + (i - begin) / 10;
+        for (size_t k = begin; k < i; ++k) {
+            auto t0 = chrono::steady_clock::now();
+            stage2.processPotentialFlow(trace[k].flowID, w);
+            double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+            (k < headEnd ? head : tail).push_back(ns);
+        }
+        auto t0 = chrono::steady_clock::now();
+        stage2.closeWindow(w, w + 1);
+        sweepNs += chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+    }
+
+    printf("%-9s head p50 %6.0f p99 %6.0f p99.9 %7.0f max %8.0f | rest p50 %6.0f p99 %6.0f p99.9 %7.0f | sweep %8.1f us/window",
+           name, percentile(head, 0.5), percentile(head, 0.99), percentile(head, 0.999), percentile(head, 1.0),
+           percentile(tail, 0.5), percentile(tail, 0.99), percentile(tail, 0.999), sweepNs / WINDOWS / 1e3);
+    printf("  (pending overflows %zu)\n", stage2.pendingTableOverflows());
+}
+
+// Inline and deferred Stage2 side by side; returns the windows after which their buckets differ.
+// Every flow sends in every window, so inline evaluation never finds an empty row after window 0:
+// any empty row deferred evaluation meets was reset by its close sweep.
+static size_t collisionCheck(const vector<PromotedPacket>& trace, size_t& inlineSubflows, size_t& deferredSubflows) {
+    Stage3Merger inlineStage3(STAGE3_RNG_SEED), deferredStage3(STAGE3_RNG_SEED);
+    Stage2Monitor inlineStage2(inlineStage3, COLLISION_STAGE2_BYTES, STAGE2_DELTA_ENCODING, false);
+    Stage2Monitor deferredStage2(deferredStage3, COLLISION_STAGE2_BYTES, STAGE2_DELTA_ENCODING, true);
+    size_t mismatches = 0, i = 0;
+    for (uint32_t w = 0; w < WINDOWS; ++w) {
+        for (; i < trace.size() && trace[i].window == w; ++i) {
+            inlineStage2.processPotentialFlow(trace[i].flowID, w);
+            deferredStage2.processPotentialFlow(trace[i].flowID, w);
+        }
+        bool same = true;
+        for (size_t row = 0; row < STAGE2_ROWS; ++row) {
+            for (size_t b = 0; b < inlineStage2.width(); ++b) {
+                same = same && inlineStage2.bucketAt(row, b).word == deferredStage2.bucketAt(row, b).word;
+            }
+        }
+        mismatches += !same;
+        inlineStage2.closeWindow(w, w + 1);
+        deferredStage2.closeWindow(w, w + 1);
+    }
+    inlineSubflows = inlineStage3.subflowsProcessed();
+    deferredSubflows = deferredStage3.subflowsProcessed();
+    return mismatches;
+}
+
+int main() {
+    vector<PromotedPacket> trace = buildTrace(FLOWS, 50);
+    printf("%zu promoted packets, %d flows, %u windows; latency in ns\n", trace.size(), FLOWS, WINDOWS);
+    run("inline", trace, false);
+    run("deferred", trace, true);
+
+    size_t inlineSubflows = 0, deferredSubflows = 0;
+    const vector<PromotedPacket> colliding = buildTrace(COLLISION_FLOWS, 10);
+    const size_t mismatches = collisionCheck(colliding, inlineSubflows, deferredSubflows);
+    printf("\ncollisions: %d flows on a %zu-byte Stage2, %zu subflows emitted inline, %zu deferred\n",
+           COLLISION_FLOWS, COLLISION_STAGE2_BYTES, inlineSubflows, deferredSubflows);
+    if (mismatches != 0) {
+        printf("FAIL: deferred buckets differ from inline after %zu of %u windows\n", mismatches, WINDOWS);
+        return 1;
+    }
+    printf("OK: deferred buckets match inline after every window\n");
+    return 0;
+}
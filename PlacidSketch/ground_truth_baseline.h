@@ -0,0 +1,400 @@
+#ifndef GROUND_TRUTH_BASELINE_H
+#define GROUND_TRUTH_BASELINE_H
+using namespace std;
+#include "parm.h"
+#include "KeyHash.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Exact stable-flow detector, the reference the sketches are evaluated against.
+// Definitions follow the sketch on exact counts: a subflow is SUBFLOW_WINDOWS consecutive windows
+// in which the flow is present, stable when their sample variance is at most STABLE_THRESHOLD.
+// Back-to-back stable subflows form a stable period while the pooled variance (the Stage3 merge
+// formula) stays within STABLE_THRESHOLD, up to P subflows; periods of at least Q subflows count.
+
+struct StablePeriod {
+    char ID[KEY_LEN];
+    uint32_t startWindow;
+    uint32_t endWindow;     // Inclusive
+    uint32_t subflows;
+    double mean;
+    double variance;
+};
+
+struct GroundTruthConfig {
+    unsigned threads = 1;
+    // Flows are split into 2^partitionBits partitions by key hash
+    uint32_t partitionBits = 8;
+    // Buffered per-window counts above this size are appended to the spill files
+    size_t memoryBytes = 1ull << 30;
+    // Directory for the spill files; empty keeps everything in memory
+    string spillDirectory;
+};
+
+// Per-flow per-window counts are hash-partitioned by flow, so partitions are counted and scanned
+// in parallel without sharing; each packet is hashed once, by the thread owning its chunk. With a spill directory only one partition per thread has to fit in
+// memory at the end, which is what bounds the trace size.
+class GroundTruthBaseline {
+public:
+    explicit GroundTruthBaseline(const GroundTruthConfig& cfg)
+        : config(cfg), partitions(size_t(1) << cfg.partitionBits) {
+        config.threads = max(1u, config.threads);
+        chunks.assign(config.threads, vector<vector<FlowKey>>(partitions.size()));
+        removeSpillFiles();
+    }
+
+    ~GroundTruthBaseline() { removeSpillFiles(); }
+
+    GroundTruthBaseline(const GroundTruthBaseline&) = delete;
+    GroundTruthBaseline& operator=(const GroundTruthBaseline&) = delete;
+
+    // Count the packets of one window; windows are added once each, in increasing order.
+    // Returns false if spilling fails.
+    bool addWindow(uint32_t window, const vector<Packet>& packets) {
+        const uint32_t threads = config.threads;
+        // Each thread hashes one contiguous chunk of the packets once, bucketing keys by partition
+        runParallel(threads, [&](uint32_t t) {
+            const size_t begin = packets.size() * t / threads;
+            const size_t end = packets.size() * (t + 1) / threads;
+            vector<vector<FlowKey>>& chunk = chunks[t];
+            for (size_t i = begin; i < end; ++i) {
+                chunk[keySlot(packets[i].flowID, config.partitionBits)].push_back(FlowKey::of(packets[i].flowID));
+            }
+        });
+        atomic<size_t> added(0);
+        runParallel(threads, [&](uint32_t t) {
+            size_t counted = 0;
+            for (uint32_t part = t; part < partitions.size(); part += threads) {
+                Partition& partition = partitions[part];
+                for (auto& chunk : chunks) {
+                    partition.keys.insert(partition.keys.end(), chunk[part].begin(), chunk[part].end());
+                    chunk[part].clear();
+                }
+                const size_t before = partition.counts.size();
+                sort(partition.keys.begin(), partition.keys.end());
+                for (size_t i = 0; i < partition.keys.size();) {
+                    size_t j = i + 1;
+                    while (j < partition.keys.size() && partition.keys[j] == partition.keys[i]) ++j;
+                    partition.counts.push_back(WindowCount{partition.keys[i], window, static_cast<uint32_t>(j - i)});
+                    i = j;
+                }
+                counted += partition.counts.size() - before;
+                partition.keys.clear();
+            }
+            added += counted;
+        });
+        records += added;
+        buffered += added;
+        if (!config.spillDirectory.empty() && buffered * sizeof(WindowCount) > config.memoryBytes) {
+            return spill();
+        }
+        return true;
+    }
+
+    // Stable periods of every flow, sorted by flow ID and start window. Consumes the counts.
+    bool finish(vector<StablePeriod>& periods) {
+        vector<vector<StablePeriod>> found(config.threads);
+        atomic<uint32_t> next(0);
+        atomic<bool> ok(true);
+        atomic<size_t> flowCount(0);
+        runParallel(config.threads, [&](uint32_t t) {
+            vector<WindowCount> counts;
+            size_t seen = 0;
+            for (uint32_t part = next++; part < partitions.size() && ok; part = next++) {
+                counts.clear();
+                if (!loadSpilled(part, counts)) {
+                    ok = false;
+                    break;
+                }
+                Partition& partition = partitions[part];
+                counts.insert(counts.end(), partition.counts.begin(), partition.counts.end());
+                vector<WindowCount>().swap(partition.counts);
+                vector<FlowKey>().swap(partition.keys);
+
+                sort(counts.begin(), counts.end(), [](const WindowCount& a, const WindowCount& b) {
+                    return a.key < b.key || (a.key == b.key && a.window < b.window);
+                });
+                for (size_t i = 0; i < counts.size();) {
+                    size_t j = i + 1;
+                    while (j < counts.size() && counts[j].key == counts[i].key) ++j;
+                    ++seen;
+                    // A period needs Q subflows, so shorter-lived flows cannot have one
+                    if (j - i >= static_cast<size_t>(Q) * SUBFLOW_WINDOWS) {
+                        detectPeriods(counts.data() + i, j - i, found[t]);
+                    }
+                    i = j;
+                }
+            }
+            flowCount += seen;
+        });
+        flows = flowCount;
+
+        periods.clear();
+        for (auto& part : found) {
+            periods.insert(periods.end(), part.begin(), part.end());
+        }
+        sort(periods.begin(), periods.end(), [](const StablePeriod& a, const StablePeriod& b) {
+            int c = memcmp(a.ID, b.ID, KEY_LEN);
+            return c < 0 || (c == 0 && a.startWindow < b.startWindow);
+        });
+        removeSpillFiles();
+        return ok;
+    }
+
+    // (flow, window) pairs counted so far
+    size_t flowWindows() const { return records; }
+    size_t spilledBytes() const { return spilled; }
+    // Distinct flows; set by finish()
+    size_t flowsSeen() const { return flows; }
+
+private:
+    struct FlowKey {
+        uint64_t lo, hi;
+
+        static FlowKey of(const char* flowID) {
+            FlowKey key;
+            memcpy(&key.lo, flowID, 8);
+            memcpy(&key.hi, flowID + 8, 8);
+            return key;
+        }
+        bool operator==(const FlowKey& o) const { return lo == o.lo && hi == o.hi; }
+        bool operator<(const FlowKey& o) const { return lo < o.lo || (lo == o.lo && hi < o.hi); }
+    };
+    static_assert(KEY_LEN == 16, "FlowKey holds the key as two 64-bit words");
+
+    struct WindowCount {
+        FlowKey key;
+        uint32_t window;
+        uint32_t count;
+    };
+
+    struct Partition {
+        vector<FlowKey> keys;        // Packets of the current window
+        vector<WindowCount> counts;  // Counts not yet spilled
+    };
+
+    // Exact counts of one flow in window order; a missing window breaks subflows and periods
+    static void detectPeriods(const WindowCount* counts, size_t n, vector<StablePeriod>& out) {
+        constexpr uint32_t L = SUBFLOW_WINDOWS;
+        bool open = false;
+        StablePeriod period{};
+        auto close = [&] {
+            if (open && period.subflows >= static_cast<uint32_t>(Q)) {
+                period.endWindow = period.startWindow + period.subflows * L - 1;
+                out.push_back(period);
+            }
+            open = false;
+        };
+
+        size_t i = 0;
+        while (i + L <= n) {
+            // Windows are distinct and increasing, so L records span L - 1 windows only if consecutive
+            if (counts[i + L - 1].window - counts[i].window != L - 1) {
+                close();
+                ++i;
+                continue;
+            }
+            double sum = 0.0;
+            for (uint32_t k = 0; k < L; ++k) sum += counts[i + k].count;
+            const double mean = sum / L;
+            double variance = 0.0;
+            for (uint32_t k = 0; k < L; ++k) variance += (counts[i + k].count - mean) * (counts[i + k].count - mean);
+            variance /= L - 1;
+            if (variance > STABLE_THRESHOLD) {
+                close();
+                ++i;
+                continue;
+            }
+
+            const uint32_t start = counts[i].window;
+            if (open && start == period.startWindow + period.subflows * L && period.subflows < static_cast<uint32_t>(P)) {
+                const double c = period.subflows;
+                const double mu = (c * period.mean + mean) / (c + 1);
+                const double pooled = (c * (period.variance + (period.mean - mu) * (period.mean - mu)) +
+                                       variance + (mean - mu) * (mean - mu)) / (c + 1);
+                if (pooled <= STABLE_THRESHOLD) {
+                    period.subflows++;
+                    period.mean = mu;
+                    period.variance = pooled;
+                    i += L;
+                    continue;
+                }
+            }
+            close();
+            memcpy(period.ID, &counts[i].key, KEY_LEN);
+            period.startWindow = start;
+            period.subflows = 1;
+            period.mean = mean;
+            period.variance = variance;
+            open = true;
+            i += L;
+        }
+        close();
+    }
+
+    string spillPath(uint32_t part) const {
+        char name[64];
+        snprintf(name, sizeof(name), "/ground_truth_%05u.bin", part);
+        return config.spillDirectory + name;
+    }
+
+    // Append every partition's buffered counts to its spill file
+    bool spill() {
+        const uint32_t threads = config.threads;
+        atomic<bool> ok(true);
+        atomic<size_t> written(0);
+        runParallel(threads, [&](uint32_t t) {
+            for (uint32_t part = t; part < partitions.size(); part += threads) {
+                Partition& partition = partitions[part];
+                if (partition.counts.empty()) continue;
+                FILE* out = fopen(spillPath(part).c_str(), "ab");
+                if (!out) {
+                    ok = false;
+                    return;
+                }
+                const size_t n = partition.counts.size();
+                ok = ok && fwrite(partition.counts.data(), sizeof(WindowCount), n, out) == n;
+                ok = (fclose(out) == 0) && ok;
+                written += n * sizeof(WindowCount);
+                vector<WindowCount>().swap(partition.counts);
+            }
+        });
+        spilled += written;
+        buffered = 0;
+        return ok;
+    }
+
+    bool loadSpilled(uint32_t part, vector<WindowCount>& counts) const {
+        if (config.spillDirectory.empty()) {
+            return true;
+        }
+        FILE* in = fopen(spillPath(part).c_str(), "rb");
+        if (!in) {
+            return true;  // Nothing spilled for this partition
+        }
+        WindowCount chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, sizeof(WindowCount), 4096, in)) > 0) {
+            counts.insert(counts.end(), chunk, chunk + n);
+        }
+        bool ok = !ferror(in);
+        fclose(in);
+        return ok;
+    }
+
+    void removeSpillFiles() const {
+        if (config.spillDirectory.empty()) {
+            return;
+        }
+        for (uint32_t part = 0; part < partitions.size(); ++part) {
+            remove(spillPath(part).c_str());
+        }
+    }
+
+    template <class Body>
+    static void runParallel(uint32_t count, Body&& body) {
+        vector<thread> workers;
+        for (uint32_t i = 1; i < count; ++i) {
+            workers.emplace_back([&body, i] { body(i); });
+        }
+        if (count > 0) {
+            body(0);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    GroundTruthConfig config;
+    vector<Partition> partitions;
+    // Keys of the current window per hashing thread and partition, merged into Partition::keys
+    vector<vector<vector<FlowKey>>> chunks;
+    size_t records = 0;
+    size_t buffered = 0;
+    size_t spilled = 0;
+    size_t flows = 0;
+};
+
+// Accuracy of reported stable flows against the exact periods. A report matches a true period of
+// the same flow when their windows overlap; ARE compares each detected period with the report
+// overlapping it most.
+struct DetectionAccuracy {
+    size_t truePeriods = 0;
+    size_t reports = 0;
+    size_t matchedReports = 0;
+    size_t detectedPeriods = 0;
+    double precision = 0.0;
+    double recall = 0.0;
+    double f1 = 0.0;
+    double lengthARE = 0.0;  // Windows covered
+    double meanARE = 0.0;    // Mean packets per window
+};
+
+// Report needs ID, startWindow, endWindow (inclusive) and mean, as StableFlowReport has
+template <class Report>
+DetectionAccuracy compareWithGroundTruth(const vector<StablePeriod>& truth, vector<Report> reports) {
+    sort(reports.begin(), reports.end(), [](const Report& a, const Report& b) {
+        int c = memcmp(a.ID, b.ID, KEY_LEN);
+        return c < 0 || (c == 0 && a.startWindow < b.startWindow);
+    });
+    auto overlap = [](uint32_t s1, uint32_t e1, uint32_t s2, uint32_t e2) -> uint32_t {
+        uint32_t s = max(s1, s2), e = min(e1, e2);
+        return s <= e ? e - s + 1 : 0;
+    };
+
+    DetectionAccuracy acc;
+    acc.truePeriods = truth.size();
+    acc.reports = reports.size();
+    double lengthError = 0.0, meanError = 0.0;
+    size_t r = 0;
+    for (size_t t0 = 0; t0 < truth.size();) {
+        size_t t1 = t0 + 1;
+        while (t1 < truth.size() && memcmp(truth[t1].ID, truth[t0].ID, KEY_LEN) == 0) ++t1;
+        while (r < reports.size() && memcmp(reports[r].ID, truth[t0].ID, KEY_LEN) < 0) ++r;
+        size_t r1 = r;
+        while (r1 < reports.size() && memcmp(reports[r1].ID, truth[t0].ID, KEY_LEN) == 0) ++r1;
+
+        for (size_t t = t0; t < t1; ++t) {
+            const StablePeriod& period = truth[t];
+            size_t best = r1;
+            uint32_t bestOverlap = 0;
+            for (size_t q = r; q < r1; ++q) {
+                uint32_t o = overlap(period.startWindow, period.endWindow, reports[q].startWindow, reports[q].endWindow);
+                if (o > bestOverlap) {
+                    bestOverlap = o;
+                    best = q;
+                }
+            }
+            if (best == r1) continue;
+            acc.detectedPeriods++;
+            const double length = period.endWindow - period.startWindow + 1;
+            lengthError += fabs((reports[best].endWindow - reports[best].startWindow + 1) - length) / length;
+            meanError += fabs(reports[best].mean - period.mean) / period.mean;
+        }
+        for (size_t q = r; q < r1; ++q) {
+            for (size_t t = t0; t < t1; ++t) {
+                if (overlap(truth[t].startWindow, truth[t].endWindow, reports[q].startWindow, reports[q].endWindow)) {
+                    acc.matchedReports++;
+                    break;
+                }
+            }
+        }
+        r = r1;
+        t0 = t1;
+    }
+
+    acc.precision = acc.reports ? static_cast<double>(acc.matchedReports) / acc.reports : 0.0;
+    acc.recall = acc.truePeriods ? static_cast<double>(acc.detectedPeriods) / acc.truePeriods : 0.0;
+    acc.f1 = acc.precision + acc.recall > 0 ? 2 * acc.precision * acc.recall / (acc.precision + acc.recall) : 0.0;
+    acc.lengthARE = acc.detectedPeriods ? lengthError / acc.detectedPeriods : 0.0;
+    acc.meanARE = acc.detectedPeriods ? meanError / acc.detectedPeriods : 0.0;
+    return acc;
+}
+
+#endif
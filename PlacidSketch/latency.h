@@ -0,0 +1,121 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+using namespace std;
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Per-packet latency histograms around PlacidSketch::processPacket, compiled out unless built
+// with -DPLACID_LATENCY=1. Values are TSC ticks on x86 and nanoseconds elsewhere.
+#ifndef PLACID_LATENCY
+#define PLACID_LATENCY 0
+#endif
+
+inline uint64_t readCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// HDR-style log-linear histogram: values below 2^SUB_BITS are exact, every power of two above
+// that is split into 2^SUB_BITS buckets, so any recorded value is within 1/16 of its bucket bound.
+class LatencyHistogram {
+public:
+    static constexpr uint32_t SUB_BITS = 4;
+    static constexpr uint32_t SUB_COUNT = 1u << SUB_BITS;
+    static constexpr uint32_t BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    void record(uint64_t value) {
+        ++counts[bucketFor(value)];
+        ++total;
+        maxValue = value > maxValue ? value : maxValue;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maxValue; }
+
+    // Upper bound of the bucket holding the q-quantile (0 for an empty histogram)
+    uint64_t percentile(double q) const {
+        if (total == 0) {
+            return 0;
+        }
+        const uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                const uint64_t upper = i + 1 < BUCKETS ? lowerBound(i + 1) - 1 : UINT64_MAX;
+                return upper < maxValue ? upper : maxValue;
+            }
+        }
+        return maxValue;
+    }
+
+    void reset() {
+        counts.fill(0);
+        total = 0;
+        maxValue = 0;
+    }
+
+private:
+    array<uint64_t, BUCKETS> counts{};
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+
+    static uint32_t bucketFor(uint64_t value) {
+        if (value < SUB_COUNT) {
+            return static_cast<uint32_t>(value);
+        }
+        const uint32_t msb = 63 - static_cast<uint32_t>(__builtin_clzll(value));
+        const uint32_t group = msb - SUB_BITS + 1;
+        return (group << SUB_BITS) + static_cast<uint32_t>((value >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+    }
+
+    static uint64_t lowerBound(uint32_t bucket) {
+        if (bucket < SUB_COUNT) {
+            return bucket;
+        }
+        const uint32_t group = bucket >> SUB_BITS;
+        return static_cast<uint64_t>(SUB_COUNT + (bucket & (SUB_COUNT - 1))) << (group - 1);
+    }
+};
+
+// Packets that opened a window (and paid for resetBuckets and closeWindow), packets that reached
+// Stage3, and everything else
+enum LatencyClass : uint32_t {
+    LATENCY_NORMAL = 0,
+    LATENCY_WINDOW_RESET = 1,
+    LATENCY_STAGE3 = 2,
+    LATENCY_CLASSES = 3
+};
+
+struct PacketLatency {
+    array<LatencyHistogram, LATENCY_CLASSES> histograms;
+
+    void record(LatencyClass latencyClass, uint64_t ticks) { histograms[latencyClass].record(ticks); }
+
+    // One line per class for the closed window, then start the next window from empty histograms
+    void dump(uint32_t window, FILE* out = stderr) {
+        static const char* const names[LATENCY_CLASSES] = {"normal", "window-reset", "stage3"};
+        for (uint32_t c = 0; c < LATENCY_CLASSES; ++c) {
+            const LatencyHistogram& h = histograms[c];
+            fprintf(out, "latency window=%u class=%s count=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu\n",
+                    window, names[c], (unsigned long long)h.count(), (unsigned long long)h.percentile(0.50),
+                    (unsigned long long)h.percentile(0.90), (unsigned long long)h.percentile(0.99),
+                    (unsigned long long)h.percentile(0.999), (unsigned long long)h.max());
+        }
+        for (auto& h : histograms) {
+            h.reset();
+        }
+    }
+};
+
+#endif
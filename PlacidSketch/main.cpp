@@ -1,7 +1,7 @@
 #include "parm.h"
-#include "stage1.h"
-#include "stage2.h"
-#include "stage3.h"
+#include "PlacidSketch.h"
+#include "ConfigDispatch.h"
+#include <cstdio>
 #include <fstream>
 #include <algorithm>
 #include <iostream>
@@ -81,55 +81,66 @@ public:
 };
 
 
-class PlacidSketch {
-private:
-    Stage3Merger stage3;
-    Stage1Filter stage1;
-    Stage2Monitor stage2;
+static void usage() {
+    fprintf(stderr, "usage: main [--data DIR] [--preset NAME] [--config FILE] [--<parameter> VALUE ...]\n"
+                    "parameters: subflow-windows min-subflows counter-bits alpha-threshold stable-threshold\n"
+                    "            p q stage1-rows stage2-rows stage3-buckets stage1-bytes stage2-bytes stage3-bytes\n"
+                    "precompiled configurations:\n");
+    printConfigs(stderr);
+}
 
-    uint32_t currentWindow = 0;
-
-public:
-    explicit PlacidSketch(size_t stage1MemoryBytes = STAGE1_MEMORY_BYTES, 
-                         size_t stage2MemoryBytes = STAGE2_MEMORY_BYTES)
-        : stage1(stage1MemoryBytes), stage2(stage3, stage2MemoryBytes) {
-    }
-
-    void processPacket(const Packet& packet) {
-        uint32_t windowSeq = packet.windowNumber;
+int main(int argc, char** argv) {
+    cout << "PlacidSketch Stable Flow Detection" << endl;
 
-        if (windowSeq != currentWindow) {
-            stage1.resetBuckets(currentWindow);
-            currentWindow = windowSeq;
+    // Later options override earlier ones: a preset or config file first, then single parameters
+    string folderPath = "data";
+    SketchParameters params;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (i + 1 >= argc || arg.compare(0, 2, "--") != 0) {
+            usage();
+            return 2;
         }
-
-        if (stage1.processPacket(packet.flowID, windowSeq)) {
-            stage2.processPotentialFlow(packet.flowID, windowSeq);
+        const string value = argv[++i];
+        bool ok = true;
+        if (arg == "--data") folderPath = value;
+        else if (arg == "--preset") ok = presetParameters(value, params);
+        else if (arg == "--config") ok = params.load(value);
+        else ok = params.set(arg.substr(2), value);
+        if (!ok) {
+            fprintf(stderr, "bad option %s %s\n", arg.c_str(), value.c_str());
+            usage();
+            return 2;
         }
     }
-    void finalizeProcessing() {
-        stage1.resetBuckets(currentWindow);
-        stage3.finalize();
-    }
-};
-
 
-int main() {
-    cout << "PlacidSketch Stable Flow Detection" << endl;
+    if (!dispatchConfig(params, [](auto) {})) {
+        fprintf(stderr, "no precompiled configuration has ");
+        params.print(stderr);
+        fprintf(stderr, "\n");
+        usage();
+        return 2;
+    }
 
     PacketProcessor dataLoader;
-    string folderPath = "data"; // Change this to your data directory path
-    
     if (!dataLoader.loadDataFromFolder(folderPath)) {
         return 1;
     }
 
     const auto& packets = dataLoader.getPackets();
-    cout << "\n============== PlacidSketch Processing ==============" << endl;
-    PlacidSketch sketch;
-    for (const auto& packet : packets) {
-        sketch.processPacket(packet);
-    }
-    sketch.finalizeProcessing();
+    dispatchConfig(params, [&](auto config) {
+        using Config = decltype(config);
+        cout << "\n============== PlacidSketch Processing (" << Config::NAME << ") ==============" << endl;
+        PlacidSketch<Config> sketch(params.stage1Bytes, params.stage2Bytes, params.stage3Bytes);
+        size_t reported = 0;
+        auto count = [&](const StableFlowReport&) { ++reported; };
+        for (const auto& packet : packets) {
+            sketch.processPacket(packet);
+            sketch.drainStableFlows(count);
+        }
+        sketch.finalizeProcessing();
+        sketch.drainStableFlows(count);
+        cout << "Stable flows reported: " << reported << endl;
+    });
     return 0;
-}
\ No newline at end of file
+}
@@ -16,6 +16,13 @@ constexpr int STAGE2_ROWS = 2;
 
 constexpr size_t STAGE3_MEMORY_BYTES = 200ull * 1024;
 constexpr int STAGE3_BUCKETS = 4;
+// Seed of the Stage3 replacement RNG; fixed so that runs are reproducible
+constexpr uint32_t STAGE3_RNG_SEED = 0x5eed;
+// Stage3 top-k rankings (longest and steadiest flows) kept as cells change, 24 bytes per cell taken from
+// the Stage3 memory budget (about 40% fewer cells); false answers top-k queries by scanning every cell
+constexpr bool STAGE3_TOP_K = false;
+// Stage3 reports held until drained (40 bytes each, reserved up front); reports beyond that are dropped and counted
+constexpr size_t STAGE3_REPORT_CAPACITY = 65536;
 
 constexpr int SUBFLOW_WINDOWS = 5;
 constexpr int COUNTER_BITS = 8;
@@ -26,6 +33,64 @@ constexpr int P = 400;
 constexpr int Q = 40;
 constexpr float STABLE_THRESHOLD = 5.0f;
 
+// Compile-time configuration of a PlacidSketch instance: the stages and PlacidSketch are templates on
+// a config struct, so every configuration gets its own fully specialised code. DefaultConfig carries
+// the values above; other configurations derive from it and override what differs (ConfigDispatch.h).
+struct DefaultConfig {
+    static constexpr const char* NAME = "default";
+    static constexpr int SUBFLOW_WINDOWS = ::SUBFLOW_WINDOWS;
+    static constexpr int MIN_SUBFLOWS = ::MIN_SUBFLOWS;
+    static constexpr int COUNTER_BITS = ::COUNTER_BITS;
+    static constexpr int ALPHA_THRESHOLD = ::ALPHA_THRESHOLD;
+    static constexpr float STABLE_THRESHOLD = ::STABLE_THRESHOLD;
+    static constexpr int P = ::P;
+    static constexpr int Q = ::Q;
+    static constexpr int STAGE1_ROWS = ::STAGE1_ROWS;
+    static constexpr int STAGE2_ROWS = ::STAGE2_ROWS;
+    static constexpr int STAGE3_BUCKETS = ::STAGE3_BUCKETS;
+};
+
+// Sketch tables are mapped on 2 MB huge pages when the kernel has them: explicit huge pages first,
+// then transparent huge pages (TableArena.h); false maps plain 4 KB pages
+constexpr bool TABLE_ARENA_HUGE_PAGES = true;
+// Arena room beyond the stage memory budgets, for the caches and tables outside them
+constexpr size_t TABLE_ARENA_EXTRA_BYTES = 1ull << 20;
+
+// Stage1 packed buckets: 6 bits each in a continuity plane and a flag plane instead of a byte,
+// a third more buckets for the same STAGE1_MEMORY_BYTES
+constexpr bool STAGE1_PACKED_BUCKETS = false;
+
+// Stage1 promoted-flow cache entries (direct-mapped, 32 bytes each, outside the Stage1 memory budget; 0 disables)
+constexpr size_t STAGE1_PROMOTED_CACHE_ENTRIES = 256;
+
+// Stage2 null-bucket transitions via precomputed lookup table (false: reference if/else ladder); off until
+// stage2_transition_bench measures the table faster than the ladder
+constexpr bool STAGE2_TRANSITION_TABLE = false;
+
+// Stage2 delta-encoded cells (5 bytes instead of 8); the ratio of Stage2 memory set aside for escaped wide buckets
+constexpr bool STAGE2_DELTA_ENCODING = false;
+constexpr double STAGE2_DELTA_ESCAPE_RATIO = 1.0 / 8.0;
+
+// Stage2 deferred evaluation: stability checks and subflow emission run in one sweep at window close;
+// the pending table holds the flows opened per window (outside the Stage2 memory budget)
+constexpr bool STAGE2_DEFERRED_EVALUATION = false;
+constexpr size_t STAGE2_PENDING_CAPACITY = 4096;
+// Stage2 aging: buckets with no window opened for more than SUBFLOW_WINDOWS windows are treated as empty
+constexpr bool STAGE2_AGING = true;
+// Windows per full pass of the Stage2 aging sweep; each window passed visits 1/period of the buckets
+constexpr uint32_t STAGE2_AGING_SWEEP_PERIOD = 8;
+// Stage2 pre-aggregation: later packets of a flow in a window are counted in a direct-mapped table
+// (32 bytes per entry, outside the Stage2 memory budget) and applied to the rows in bulk
+constexpr bool STAGE2_PREAGGREGATION = false;
+constexpr size_t STAGE2_PREAGG_ENTRIES = 4096;
+
+// Timestamp windowing (ReorderBuffer.h): window length, how late a packet may arrive behind the newest
+// one and still count in its window, and the most packets held for reordering (16 bytes each, outside
+// the stage memory budgets)
+constexpr uint64_t WINDOW_GRANULARITY_NS = 100000000ull;
+constexpr uint64_t REORDER_LATENESS_NS = 5000000ull;
+constexpr size_t REORDER_CAPACITY = 65536;
+
 struct Packet {
     char flowID[KEY_LEN];
     char quintuple[KEY_LEN1];
@@ -3,9 +3,14 @@
 using namespace std;
 #include "parm.h"
 #include "MurmurHash3.h"
+#include "KeyHash.h"
+#include "TableArena.h"
+#include "stats.h"
+#include "trace.h"
 #include <cstring>
 #include <vector>
 #include <iostream>
+#include <array>
 // Stage1 bucket: quickly records flow continuity
 struct Stage1Bucket {
     uint8_t continuity : 4; // Continuity window count (0-15), records flow arrivals in consecutive windows
@@ -25,28 +30,196 @@ struct Stage1Bucket {
     }
 };
 
+// Promoted-flow cache entry: a flow whose buckets all carried the jump flag, with their indices
+// and the last window in which its packets set arrival in those buckets
+template <int Rows>
+struct alignas(32) PromotedFlowEntry {
+    char key[KEY_LEN];
+    array<uint32_t, Rows> index;
+    uint32_t window = UINT32_MAX; // UINT32_MAX: empty entry
+};
+
 // Stage1: detects candidate stable flows
+template <class Config = DefaultConfig>
 class Stage1Filter {
 private:
-    vector<vector<Stage1Bucket>> buckets; // Multi-row hash table: d rows × m buckets
-    vector<uint32_t> hashSeeds;           // Hash seed for each row, ensuring different hash functions per row
+    static constexpr int STAGE1_ROWS = Config::STAGE1_ROWS;
+    using PromotedFlowEntry = ::PromotedFlowEntry<STAGE1_ROWS>;
+
+    TableArena ownTables;                 // Used when no arena is passed in
+    array<ArenaSpan<Stage1Bucket>, STAGE1_ROWS> buckets; // Multi-row hash table: d rows × m buckets
+    array<uint32_t, STAGE1_ROWS> hashSeeds; // Hash seed for each row, ensuring different hash functions per row
+    size_t bucketsPerRow = 0;
+
+    // Packed storage: a bucket's 6 bits split into a 4-bit continuity plane (two buckets per byte) and
+    // a 2-bit flag plane (arrival | jump << 1, four buckets per byte), so the same memory holds a third
+    // more buckets. Rows are padded to whole groups of 16 buckets (8 continuity bytes, 4 flag bytes)
+    // so that resetBuckets works a group at a time with word operations.
+    static constexpr size_t PACKED_GROUP = 16;
+    static constexpr size_t PACKED_GROUP_BYTES = 12;
+    bool packed = false;
+    array<ArenaSpan<uint8_t>, STAGE1_ROWS> continuityPlane;
+    array<ArenaSpan<uint8_t>, STAGE1_ROWS> flagPlane;
+
+    Stage1Bucket loadPacked(size_t row, size_t index) const {
+        Stage1Bucket b;
+        b.continuity = (continuityPlane[row][index >> 1] >> ((index & 1) * 4)) & 15;
+        const uint8_t flags = (flagPlane[row][index >> 2] >> ((index & 3) * 2)) & 3;
+        b.arrival = flags & 1;
+        b.jump = flags >> 1;
+        return b;
+    }
+
+    void storePacked(size_t row, size_t index, const Stage1Bucket& b) {
+        uint8_t& continuity = continuityPlane[row][index >> 1];
+        const uint32_t nibble = (index & 1) * 4;
+        continuity = static_cast<uint8_t>((continuity & ~(15u << nibble)) | (uint32_t(b.continuity) << nibble));
+        uint8_t& flags = flagPlane[row][index >> 2];
+        const uint32_t lane = (index & 3) * 2;
+        flags = static_cast<uint8_t>((flags & ~(3u << lane)) | ((uint32_t(b.arrival) | uint32_t(b.jump) << 1) << lane));
+    }
+
+    // Bucket to operate on: in place, or unpacked into scratch and written back by commitBucket
+    Stage1Bucket* bindBucket(size_t row, size_t index, Stage1Bucket& scratch) {
+        if (!packed) {
+            return &buckets[row][index];
+        }
+        scratch = loadPacked(row, index);
+        return &scratch;
+    }
+
+    void commitBucket(size_t row, size_t index, const Stage1Bucket& b) {
+        if (packed) {
+            storePacked(row, index, b);
+        }
+    }
+
+    // Bit 2k of a 32-bit flag-plane word to bit 4k of a 64-bit continuity-plane word
+    static uint64_t laneToNibble(uint32_t lanes) {
+        uint64_t x = lanes;
+        x = (x | x << 16) & 0x0000ffff0000ffffull;
+        x = (x | x << 8) & 0x00ff00ff00ff00ffull;
+        x = (x | x << 4) & 0x0f0f0f0f0f0f0f0full;
+        x = (x | x << 2) & 0x3333333333333333ull;
+        x = (x | x << 1) & 0x5555555555555555ull;
+        return x;
+    }
+
+    // resetBuckets on the planes: 16 buckets per step
+    void resetPackedBuckets(uint8_t cur) {
+        for (size_t row = 0; row < STAGE1_ROWS; ++row) {
+            uint8_t* continuity = continuityPlane[row].data();
+            uint8_t* flags = flagPlane[row].data();
+            for (size_t g = 0; g < flagPlane[row].size() / 4; ++g) {
+                uint32_t f;
+                memcpy(&f, flags + g * 4, 4);
+                // Lane bit 0 of each bucket whose arrival is not cur; resetting an empty one is a no-op
+                const uint32_t stale = (cur ? ~f : f) & 0x55555555u;
+                if (!stale) continue;
+                uint64_t c;
+                memcpy(&c, continuity + g * 8, 8);
+#if PLACID_STATS
+                const uint64_t occupied = ((c | c >> 1 | c >> 2 | c >> 3) & 0x1111111111111111ull) |
+                                          laneToNibble((f | f >> 1) & 0x55555555u);
+                placidStats().stage1.resets += __builtin_popcountll(laneToNibble(stale) & occupied);
+#endif
+                f &= ~(stale | stale << 1);
+                c &= ~(laneToNibble(stale) * 15);
+                memcpy(flags + g * 4, &f, 4);
+                memcpy(continuity + g * 8, &c, 8);
+            }
+        }
+    }
+
+    // Direct-mapped cache of promoted flows, checked before the row probes. A hit skips the hashes:
+    // the first packet of a window writes arrival through the cached indices, later ones return at once.
+    // An entry is only trusted for the window it was written in and the one after it, since the
+    // resetBuckets in between cannot clear buckets whose arrival was set in the closing window.
+    ArenaSpan<PromotedFlowEntry> promotedCache;
+    uint32_t cacheBits = 0;
+    uint32_t lastResetWindow = UINT32_MAX;
+    size_t cacheHits = 0;
+
+    // Returns true when the cache proves the flow is still promoted; arrival is then up to date
+    bool promotedCacheHit(const char* flowID, uint32_t windowSeq, uint8_t cur) {
+        PromotedFlowEntry& entry = promotedCache[keySlot(flowID, cacheBits)];
+        if (entry.window == UINT32_MAX || memcmp(entry.key, flowID, KEY_LEN) != 0) {
+            return false;
+        }
+        if (entry.window == windowSeq) {
+            ++cacheHits;
+            return true;
+        }
+        if (entry.window != lastResetWindow) {
+            return false;
+        }
+        for (size_t i = 0; i < STAGE1_ROWS; i++) {
+            Stage1Bucket scratch;
+            Stage1Bucket* b = bindBucket(i, entry.index[i], scratch);
+            b->arrival = cur;
+            commitBucket(i, entry.index[i], *b);
+        }
+        entry.window = windowSeq;
+        ++cacheHits;
+        return true;
+    }
+
+    void cachePromotedFlow(const char* flowID, uint32_t windowSeq, const array<uint32_t, STAGE1_ROWS>& index) {
+        if (promotedCache.empty()) {
+            return;
+        }
+        PromotedFlowEntry& entry = promotedCache[keySlot(flowID, cacheBits)];
+        memcpy(entry.key, flowID, KEY_LEN);
+        entry.index = index;
+        entry.window = windowSeq;
+    }
 
 public:
-    // Constructor: accepts memory parameter (bytes)
-    explicit Stage1Filter(size_t memoryBytes = STAGE1_MEMORY_BYTES) {
+    // Constructor: accepts memory parameter (bytes), the promoted-flow cache size (0 disables it),
+    // packed or byte-per-bucket storage, and the arena to take the tables from (nullptr: one of its own)
+    explicit Stage1Filter(size_t memoryBytes = STAGE1_MEMORY_BYTES,
+                          size_t promotedCacheEntries = STAGE1_PROMOTED_CACHE_ENTRIES,
+                          bool usePackedBuckets = STAGE1_PACKED_BUCKETS,
+                          TableArena* arena = nullptr) : packed(usePackedBuckets) {
         size_t rows = STAGE1_ROWS;
         size_t bucketSize = sizeof(Stage1Bucket);
         size_t perRowBytes = (rows > 0) ? (memoryBytes / rows) : 0;
-        size_t bucketsPerRow = (bucketSize > 0) ? max<size_t>(1, perRowBytes / bucketSize) : 1;
+        TableArena& tables = arena ? *arena : ownTables;
+        tables.reserve(memoryBytes + promotedCacheEntries * sizeof(PromotedFlowEntry));
 
-        // Initialize multi-row hash table
-        buckets.resize(rows, vector<Stage1Bucket>(bucketsPerRow));
-        hashSeeds.resize(rows);
+        // Initialize multi-row hash table; all-zero buckets are empty
+        if (!packed) {
+            bucketsPerRow = (bucketSize > 0) ? max<size_t>(1, perRowBytes / bucketSize) : 1;
+            for (auto& row : buckets) {
+                row = tables.allocate<Stage1Bucket>(bucketsPerRow);
+            }
+        } else {
+            const size_t groups = max<size_t>(1, perRowBytes / PACKED_GROUP_BYTES);
+            bucketsPerRow = groups * PACKED_GROUP;
+            for (size_t i = 0; i < rows; i++) {
+                continuityPlane[i] = tables.allocate<uint8_t>(groups * 8);
+                flagPlane[i] = tables.allocate<uint8_t>(groups * 4);
+            }
+        }
         
         // Generate different hash seeds for each row
         for (size_t i = 0; i < rows; i++) {
             hashSeeds[i] = 0x100 + (uint32_t)i * 0x123;
         }
+
+        // Direct-mapped: round the entry count down to a power of two
+        if (promotedCacheEntries > 0) {
+            cacheBits = slotBitsFor(promotedCacheEntries);
+            promotedCache = tables.allocate(size_t(1) << cacheBits, PromotedFlowEntry());
+        }
+    }
+
+    // Packets answered by the promoted-flow cache without probing the rows
+    size_t promotedCacheHits() const { return cacheHits; }
+
+    size_t width() const { return bucketsPerRow; }
+    Stage1Bucket bucketAt(size_t row, size_t index) const {
+        return packed ? loadPacked(row, index) : buckets[row][index];
     }
 
     // Flow arrives, returns whether promoted to Stage2
@@ -54,13 +227,21 @@ public:
         uint8_t cur = windowSeq % 2; // Calculate current window number (0/1)
         bool allContinuity5 = true;  // Check if all rows reached continuity threshold
 
+        if (!promotedCache.empty() && promotedCacheHit(flowID, windowSeq, cur)) {
+            return true;
+        }
+
         // Case 1: Check if flow is already promoted in all rows
+        array<uint32_t, STAGE1_ROWS> index;
+        array<Stage1Bucket, STAGE1_ROWS> scratch;
+        array<Stage1Bucket*, STAGE1_ROWS> bound;
         bool allJumped = true;
         for (size_t i = 0; i < STAGE1_ROWS; i++) {
             uint32_t h = 0;
             MurmurHash3_x86_32(flowID, KEY_LEN, hashSeeds[i], &h);
-            Stage1Bucket& b = buckets[i][h % buckets[i].size()];
-            if (!b.jump) {
+            index[i] = h % bucketsPerRow;
+            bound[i] = bindBucket(i, index[i], scratch[i]);
+            if (!bound[i]->jump) {
                 allJumped = false;
                 break;
             }
@@ -69,11 +250,10 @@ public:
         if (allJumped) {
             // Case 1: Flow already promoted, only update arrival field, other fields unchanged
             for (size_t i = 0; i < STAGE1_ROWS; i++) {
-                uint32_t h = 0;
-                MurmurHash3_x86_32(flowID, KEY_LEN, hashSeeds[i], &h);
-                Stage1Bucket& b = buckets[i][h % buckets[i].size()];
-                b.arrival = cur;
+                bound[i]->arrival = cur;
+                commitBucket(i, index[i], *bound[i]);
             }
+            cachePromotedFlow(flowID, windowSeq, index);
             return true; // Promoted to Stage2
         }
 
@@ -81,13 +261,16 @@ public:
         for (size_t i = 0; i < STAGE1_ROWS; i++) {
             uint32_t h = 0;
             MurmurHash3_x86_32(flowID, KEY_LEN, hashSeeds[i], &h);
-            Stage1Bucket& b = buckets[i][h % buckets[i].size()];
+            index[i] = h % bucketsPerRow;
+            bound[i] = bindBucket(i, index[i], scratch[i]);
+            Stage1Bucket& b = *bound[i];
 
             if (b.empty()) {
                 // Case 2: Bucket empty, initialize continuity=1, set arrival
                 b.continuity = 1;
                 b.arrival = cur;
                 allContinuity5 = false;
+                PLACID_STAT(stage1, emptyInits);
             } else if (b.arrival == cur) {
                 // Case 3: Repeated arrival in same window, no update
                 if (b.continuity != 15) {
@@ -104,17 +287,19 @@ public:
                     allContinuity5 = false;
                 }
             }
+            commitBucket(i, index[i], b);
         }
 
         // Check if all rows reached continuity threshold
         if (allContinuity5) {
             // Flow promotion: set jump flag in all rows
             for (size_t i = 0; i < STAGE1_ROWS; i++) {
-                uint32_t h = 0;
-                MurmurHash3_x86_32(flowID, KEY_LEN, hashSeeds[i], &h);
-                Stage1Bucket& b = buckets[i][h % buckets[i].size()];
-                b.jump = 1;
+                bound[i]->jump = 1;
+                commitBucket(i, index[i], *bound[i]);
             }
+            cachePromotedFlow(flowID, windowSeq, index);
+            PLACID_STAT(stage1, promotions);
+            PLACID_PROBE2(stage1_promote, flowID, windowSeq);
 
             return true;
         }
@@ -124,13 +309,22 @@ public:
     // Reset buckets not present in current window
     void resetBuckets(uint32_t windowSeq) {
         uint8_t cur = windowSeq % 2;
+        if (packed) {
+            resetPackedBuckets(cur);
+            lastResetWindow = windowSeq;
+            return;
+        }
         for (auto& row : buckets) {
             for (auto& b : row) {
                 if (b.empty()) continue;
                 // Reset buckets not accessed in current window
-                if (b.arrival != cur) b.reset();
+                if (b.arrival != cur) {
+                    b.reset();
+                    PLACID_STAT(stage1, resets);
+                }
             }
         }
+        lastResetWindow = windowSeq;
     }
 };
 
@@ -4,118 +4,496 @@ using namespace std;
 #include "parm.h"
 #include "stage3.h"
 #include "MurmurHash3.h"
+#include "KeyHash.h"
+#include "TableArena.h"
+#include "stats.h"
+#include "trace.h"
 #include <numeric>
 #include <cstring>
 #include <string>
 #include <array>
-// Stage2 bucket structure
-struct Stage2Bucket {
-    array<uint8_t, SUBFLOW_WINDOWS + 1> cx{};
-    uint8_t initialized_flags;
-    uint8_t ck1: 3;
-    uint8_t ck2: 3;
-    uint8_t ck1_is_null: 1;
-    uint8_t ck2_is_null: 1;
+#include <type_traits>
+// Stage2 bucket: one word, updated with SWAR (SIMD-within-a-register) operations
+//   bits [0, R*COUNTER_BITS)   per-window counters cx[0..R-1], one lane per ring slot
+//   next R bits                initialized flags, one per counter
+//   next 3 + 3 bits            ck1 / ck2 codes: (ck - 1) & 7, so the all-zero word is a reset bucket
+//   next 4 bits                epoch tag: absolute window mod 16 of the last window opened
+// ck never exceeds 6, which leaves code 6 (ck == 7) free to mark a null CK field.
+// The word is the narrowest of 64 and 128 bits that holds the fields: with R = 6, 4- and 8-bit
+// counters take 40 and 64 bits of a 64-bit word, 12- and 16-bit counters 88 and 112 bits of a
+// 128-bit one. Wider counters wrap (rebirth) less often on heavy links at twice the bucket size.
+template <class Config = DefaultConfig>
+struct Stage2BucketLayout {
+    static constexpr int COUNTER_BITS = Config::COUNTER_BITS;
+    static_assert(COUNTER_BITS == 4 || COUNTER_BITS == 8 || COUNTER_BITS == 12 || COUNTER_BITS == 16,
+                  "Stage2 counters are 4, 8, 12 or 16 bits wide");
+    static constexpr uint32_t R = Config::SUBFLOW_WINDOWS + 1;
+    static constexpr uint32_t FIELD_BITS = R * COUNTER_BITS + R + 3 + 3 + 4;
+    static_assert(FIELD_BITS <= 128, "Stage2Bucket fields must fit in a 128-bit word");
+    using Word = conditional_t<FIELD_BITS <= 64, uint64_t, unsigned __int128>;
+};
 
-    Stage2Bucket() : ck1(1), ck2(1), ck1_is_null(false), ck2_is_null(false), initialized_flags(0) {
-        cx.fill(0);
-    }
+template <class Config = DefaultConfig>
+struct alignas(sizeof(typename Stage2BucketLayout<Config>::Word)) Stage2Bucket {
+    // Config parameters; inside the class they take the place of the parm.h defaults
+    static constexpr int SUBFLOW_WINDOWS = Config::SUBFLOW_WINDOWS;
+    static constexpr int COUNTER_BITS = Config::COUNTER_BITS;
+    static constexpr int ALPHA_THRESHOLD = Config::ALPHA_THRESHOLD;
+    using Word = typename Stage2BucketLayout<Config>::Word;
+
+    static constexpr uint32_t R = SUBFLOW_WINDOWS + 1;
+    static constexpr uint32_t FLAGS_SHIFT = R * COUNTER_BITS;
+    static constexpr uint32_t CK1_SHIFT = FLAGS_SHIFT + R;
+    static constexpr uint32_t CK2_SHIFT = CK1_SHIFT + 3;
+    static constexpr uint64_t COUNTER_MASK = (1ull << COUNTER_BITS) - 1;
+    static constexpr uint64_t FLAGS_MASK = (1ull << R) - 1;
+    static constexpr uint32_t EPOCH_SHIFT = CK2_SHIFT + 3;
+    static constexpr uint64_t EPOCH_MASK = 15;
+    static constexpr uint64_t CK_NULL_CODE = 6;
+
+    Word word = 0;
+
+    static constexpr uint32_t ckShift(bool useCk1) { return useCk1 ? CK1_SHIFT : CK2_SHIFT; }
 
-    bool empty() const { return initialized_flags == 0; }
+    bool empty() const { return flags() == 0; }
+
+    uint32_t flags() const { return static_cast<uint32_t>((word >> FLAGS_SHIFT) & FLAGS_MASK); }
 
     bool isCounterNull(uint8_t index) const {
-        return !(initialized_flags & (1U << index));
+        return !(word & (Word(1) << (FLAGS_SHIFT + index)));
     }
 
-    void reset() {
-        cx.fill(0);
-        initialized_flags = 0;
-        ck1 = 1;
-        ck2 = 1;
-        ck1_is_null = false;
-        ck2_is_null = false;
+    uint32_t counter(uint8_t index) const {
+        return static_cast<uint32_t>((word >> (index * COUNTER_BITS)) & COUNTER_MASK);
     }
 
-    uint32_t countWindowNumber(){
-        uint32_t num = 0;
-        for(uint32_t i=0;i<SUBFLOW_WINDOWS + 1;i++){
-            if(initialized_flags & (1U << i)){
-                num++;
-            }
-        }
-        return num;
+    // Add one to a counter inside its lane; returns false when the counter wrapped to 0 (rebirth)
+    bool incrementCounter(uint8_t index) {
+        const uint32_t shift = index * COUNTER_BITS;
+        const Word lane = Word(COUNTER_MASK) << shift;
+        const Word next = ((word & lane) + (Word(1) << shift)) & lane;
+        word = (word & ~lane) | next;
+        return next != 0;
     }
 
-    void initializeNewWindow(uint8_t window, uint32_t absoluteWindow) {
-        cx[window] = 1;
-        initialized_flags |= (1U << window);
+    // Add amount to a counter that has at least that much room left in its lane
+    void addToCounter(uint8_t index, uint32_t amount) {
+        word += Word(amount) << (index * COUNTER_BITS);
+    }
 
-        bool useCk1 = (absoluteWindow % 2 == 0);
-        if (useCk1) {
-            ck1 = 1;
-            ck1_is_null = false;
-        } else {
-            ck2 = 1;
-            ck2_is_null = false;
-        }
+    bool ckIsNull(bool useCk1) const { return ((word >> ckShift(useCk1)) & 7) == CK_NULL_CODE; }
+
+    uint8_t ck(bool useCk1) const { return static_cast<uint8_t>(((word >> ckShift(useCk1)) + 1) & 7); }
+
+    void setCk(bool useCk1, uint8_t value) {
+        const uint32_t shift = ckShift(useCk1);
+        word = (word & ~(Word(7) << shift)) | (Word((value - 1) & 7) << shift);
+    }
+
+    void setCkNull(bool useCk1) {
+        const uint32_t shift = ckShift(useCk1);
+        word = (word & ~(Word(7) << shift)) | (Word(CK_NULL_CODE) << shift);
+    }
+
+    void reset() { word = 0; }
+
+    uint32_t epoch() const { return static_cast<uint32_t>((word >> EPOCH_SHIFT) & EPOCH_MASK); }
+
+    // Windows since the last one opened, seen from window; exact while the idle time is below 16 windows,
+    // which the aging sweep keeps it under (it resets a bucket within STAGE2_AGING_SWEEP_PERIOD windows
+    // of aging out, and sweeps the whole table when the window number jumps that far)
+    uint32_t idleWindows(uint32_t window) const { return (window - epoch()) & EPOCH_MASK; }
+
+    // No window opened for more than SUBFLOW_WINDOWS windows: every counter belongs to a dead run
+    bool isAged(uint32_t currentWindow) const {
+        return !empty() && idleWindows(currentWindow) > SUBFLOW_WINDOWS;
+    }
+
+    uint32_t countWindowNumber() const {
+        return static_cast<uint32_t>(__builtin_popcount(flags()));
+    }
+
+    // Counter := 1, flag set, CK of this window's parity := 1 (code 0), epoch := this window,
+    // all in one masked store
+    void initializeNewWindow(uint8_t window, uint32_t absoluteWindow) {
+        const uint32_t shift = window * COUNTER_BITS;
+        const Word clear = (Word(COUNTER_MASK) << shift) | (Word(7) << ckShift(absoluteWindow % 2 == 0)) |
+                           (Word(EPOCH_MASK) << EPOCH_SHIFT);
+        word = (word & ~clear) | (Word(1) << shift) | (Word(1) << (FLAGS_SHIFT + window)) |
+               (Word(absoluteWindow & EPOCH_MASK) << EPOCH_SHIFT);
     }
 
 
     // Check stability using relative rebirth algorithm with alternating CK fields
     bool checkStability(uint8_t y1, uint8_t y2, uint32_t absoluteWindow) const {
         const uint32_t base = (1u << COUNTER_BITS);
-        const uint32_t cx1 = cx[y1];
-        const uint32_t cx2 = cx[y2];
+        const uint32_t cx1 = counter(y1);
+        const uint32_t cx2 = counter(y2);
 
         bool useCk1 = (absoluteWindow % 2 == 0);
         if (isCounterNull(y1) || isCounterNull(y2)) {
             return false;
         }
-        if (useCk1) {
-            if (ck1_is_null) {
-                return false;
-            }
-            if (ck1 > 2) {
-                return false;
-            } else if (ck1 == 2) {
-                return (cx1 + base - cx2) <= ALPHA_THRESHOLD;
-            } else if (ck1 == 1) {
-                return abs(int(cx2) - int(cx1)) <= ALPHA_THRESHOLD;
-            } else {
-                return (cx2 + base - cx1) <= ALPHA_THRESHOLD;
-            }
+        if (ckIsNull(useCk1)) {
+            return false;
+        }
+        const uint8_t ckValue = ck(useCk1);
+        if (ckValue > 2) {
+            return false;
+        } else if (ckValue == 2) {
+            return (cx1 + base - cx2) <= ALPHA_THRESHOLD;
+        } else if (ckValue == 1) {
+            return abs(int(cx2) - int(cx1)) <= ALPHA_THRESHOLD;
+        } else if (useCk1) {
+            return (cx2 + base - cx1) <= ALPHA_THRESHOLD;
         } else {
-            if (ck2_is_null) {
+            return (cx1 + base - cx2) <= ALPHA_THRESHOLD;
+        }
+    }
+};
+
+// Delta-encoded Stage2 cell: 5 bytes instead of the 8-byte Stage2Bucket word (8-bit counters; the
+// cell takes 4, 7 and 8 bytes for 4-, 12- and 16-bit counters).
+// Buckets that behave well hold one contiguous run of initialized windows v0..v(n-1) with no counter
+// rebirth (both CKs at 1). Once a run has three windows, every later neighbouring pair has passed
+// checkStability, so those windows differ by at most ALPHA_THRESHOLD from the one before. Such a bucket is stored as
+//   bits [0, 3)    run length n (0 = empty, 7 = escaped)
+//   bits [3, 6)    ring slot of the newest window v(n-1)
+//   next COUNTER_BITS bits    newest counter v(n-1), the one being incremented
+//   next COUNTER_BITS bits    oldest counter v0
+//   next COUNTER_BITS bits    second counter v1 (the v0 -> v1 step is never checked)
+//   then 5 bits    signed delta v(i) - v(i-1) for each of v2..v(n-2)
+// Anything else (rebirth, gaps, deltas out of range) escapes: the cell stores an index into a pool of wide buckets.
+// The epoch tag is not part of the cell; with aging on, the monitor keeps it in a nibble plane beside the cells.
+template <class Config = DefaultConfig>
+struct DeltaStage2Cell {
+    static constexpr int SUBFLOW_WINDOWS = Config::SUBFLOW_WINDOWS;
+    static constexpr int COUNTER_BITS = Config::COUNTER_BITS;
+    using Stage2Bucket = ::Stage2Bucket<Config>;
+
+    static constexpr uint32_t R = SUBFLOW_WINDOWS + 1;
+    static constexpr uint32_t DELTA_BITS = 5;
+    static constexpr int32_t DELTA_MIN = -(1 << (DELTA_BITS - 1));
+    static constexpr int32_t DELTA_MAX = (1 << (DELTA_BITS - 1)) - 1;
+    static constexpr uint64_t ESCAPED = 7;
+    static constexpr uint32_t NEWEST_SHIFT = 6;
+    static constexpr uint32_t OLDEST_SHIFT = NEWEST_SHIFT + COUNTER_BITS;
+    static constexpr uint32_t SECOND_SHIFT = OLDEST_SHIFT + COUNTER_BITS;
+    static constexpr uint32_t DELTA_SHIFT = SECOND_SHIFT + COUNTER_BITS;
+    static constexpr uint32_t BYTES = (DELTA_SHIFT + (SUBFLOW_WINDOWS - 3) * DELTA_BITS + 7) / 8;
+    static_assert(R <= 6 && BYTES <= 8, "delta-encoded Stage2 cell does not fit in 8 bytes for these parameters");
+
+    static bool isEscaped(uint64_t cell) { return (cell & 7) == ESCAPED; }
+    static uint64_t escapeIndex(uint64_t cell) { return cell >> 3; }
+    static uint64_t makeEscaped(uint64_t index) { return (index << 3) | ESCAPED; }
+
+    // Increment v(n-1) in place when it is the counter of the current window and cannot wrap
+    static bool tryIncrementNewest(uint64_t &cell, uint8_t y_current) {
+        const uint64_t n = cell & 7;
+        if (n == 0 || n == ESCAPED || ((cell >> 3) & 7) != y_current ||
+            ((cell >> NEWEST_SHIFT) & Stage2Bucket::COUNTER_MASK) == Stage2Bucket::COUNTER_MASK) {
+            return false;
+        }
+        cell += 1ull << NEWEST_SHIFT;
+        return true;
+    }
+
+    static bool encode(const Stage2Bucket &bucket, uint64_t &cell) {
+        if (bucket.word == 0) {
+            cell = 0;
+            return true;
+        }
+        // Any CK other than 1 means a rebirth happened
+        if ((bucket.word >> Stage2Bucket::CK1_SHIFT) & 63) {
+            return false;
+        }
+        const uint32_t flags = bucket.flags();
+        const uint32_t n = static_cast<uint32_t>(__builtin_popcount(flags));
+        // The slot after each run end is null; a single contiguous run has exactly one end
+        const uint32_t next = ((flags >> 1) | (flags << (R - 1))) & Stage2Bucket::FLAGS_MASK;
+        const uint32_t ends = flags & ~next;
+        if (n >= R || __builtin_popcount(ends) != 1) {
+            return false;
+        }
+        const uint32_t last = static_cast<uint32_t>(__builtin_ctz(ends));
+        const uint32_t first = (last + R - (n - 1)) % R;
+
+        cell = n | (static_cast<uint64_t>(last) << 3) |
+               (static_cast<uint64_t>(bucket.counter(last)) << NEWEST_SHIFT) |
+               (static_cast<uint64_t>(bucket.counter(first)) << OLDEST_SHIFT);
+        if (n >= 3) {
+            cell |= static_cast<uint64_t>(bucket.counter((first + 1) % R)) << SECOND_SHIFT;
+        }
+        for (uint32_t i = 2; i + 1 < n; ++i) {
+            const int32_t delta = int32_t(bucket.counter((first + i) % R)) - int32_t(bucket.counter((first + i - 1) % R));
+            if (delta < DELTA_MIN || delta > DELTA_MAX) {
                 return false;
             }
-            if (ck2 > 2) {
-                return false;
-            } else if (ck2 == 2) {
-                return (cx1 + base - cx2) <= ALPHA_THRESHOLD;
-            } else if (ck2 == 1) {
-                return abs(int(cx2) - int(cx1)) <= ALPHA_THRESHOLD;
+            const uint64_t bits = static_cast<uint64_t>(delta) & ((1u << DELTA_BITS) - 1);
+            cell |= bits << (DELTA_SHIFT + (i - 2) * DELTA_BITS);
+        }
+        return true;
+    }
+
+    static Stage2Bucket decode(uint64_t cell) {
+        Stage2Bucket bucket;
+        const uint32_t n = static_cast<uint32_t>(cell & 7);
+        if (n == 0) {
+            return bucket;
+        }
+        const uint32_t last = static_cast<uint32_t>((cell >> 3) & 7);
+        const uint32_t first = (last + R - (n - 1)) % R;
+        uint64_t value = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            if (i + 1 == n) {
+                value = cell >> NEWEST_SHIFT;
+            } else if (i == 0) {
+                value = cell >> OLDEST_SHIFT;
+            } else if (i == 1) {
+                value = cell >> SECOND_SHIFT;
             } else {
-                return (cx1 + base - cx2) <= ALPHA_THRESHOLD;
+                // Sign-extend the delta
+                const uint64_t bits = (cell >> (DELTA_SHIFT + (i - 2) * DELTA_BITS)) & ((1u << DELTA_BITS) - 1);
+                value += static_cast<uint64_t>(static_cast<int64_t>(bits << (64 - DELTA_BITS)) >> (64 - DELTA_BITS));
             }
+            const uint32_t slot = (first + i) % R;
+            bucket.word |= typename Stage2Bucket::Word(value & Stage2Bucket::COUNTER_MASK) << (slot * COUNTER_BITS);
+            bucket.word |= typename Stage2Bucket::Word(1) << (Stage2Bucket::FLAGS_SHIFT + slot);
         }
-
+        return bucket;
     }
 };
 
+// One slice of the Stage2 aging sweep: buckets visited, and how many occupied ones were live or aged out
+struct Stage2AgingSample {
+    uint32_t window = 0;
+    size_t visited = 0;
+    size_t live = 0;
+    size_t aged = 0;
+};
+
 // Stage2 monitor: monitors flows for stability
+template <class Config = DefaultConfig>
 class Stage2Monitor {
 private:
-    vector<vector<Stage2Bucket>> buckets;
-    vector<uint32_t> rowSeeds;
+    // Config parameters; inside the class they take the place of the parm.h defaults
+    static constexpr int SUBFLOW_WINDOWS = Config::SUBFLOW_WINDOWS;
+    static constexpr int COUNTER_BITS = Config::COUNTER_BITS;
+    static constexpr int ALPHA_THRESHOLD = Config::ALPHA_THRESHOLD;
+    static constexpr float STABLE_THRESHOLD = Config::STABLE_THRESHOLD;
+    static constexpr int STAGE2_ROWS = Config::STAGE2_ROWS;
+    using Stage2Bucket = ::Stage2Bucket<Config>;
+    using BucketWord = typename Stage2Bucket::Word;
+    using DeltaStage2Cell = ::DeltaStage2Cell<Config>;
+    using Stage3Merger = ::Stage3Merger<Config>;
+
+    static_assert(sizeof(Stage2Bucket) == sizeof(BucketWord) && 64 % alignof(Stage2Bucket) == 0,
+                  "Stage2 buckets must tile cache lines without straddling");
+    static_assert(SUBFLOW_WINDOWS + STAGE2_AGING_SWEEP_PERIOD < 16,
+                  "the aging sweep must reach every idle bucket before its 4-bit epoch tag wraps");
+
+    TableArena ownTables;  // Used when no arena is passed in
+    array<ArenaSpan<Stage2Bucket>, STAGE2_ROWS> buckets;
+    array<uint32_t, STAGE2_ROWS> rowSeeds;
     uint32_t hashSeed;
     Stage3Merger &stage3;
     size_t rows = 0;
     size_t bucketsPerRow = 0;
 
+    // Delta encoding: rows of DeltaStage2Cell::BYTES-byte cells plus a pool of wide buckets for escapes
+    bool deltaEncoding = false;
+    array<ArenaSpan<uint8_t>, STAGE2_ROWS> cells;
+    ArenaSpan<Stage2Bucket> escapePool;
+    vector<uint32_t> freeEscapes;
+    size_t escapeOverflows = 0;
+
+    // Aging: buckets idle for more than SUBFLOW_WINDOWS windows are reset when probed, and each window
+    // close sweeps 1/STAGE2_AGING_SWEEP_PERIOD of the table. Delta cells keep their epoch tags in a nibble plane.
+    bool aging = false;
+    array<ArenaSpan<uint8_t>, STAGE2_ROWS> epochs;
+    size_t sweepRow = 0;
+    size_t sweepIndex = 0;
+    size_t lazilyAged = 0;
+    Stage2AgingSample lastSample;
+
     struct SelectedBucket {
         Stage2Bucket *bucket;
+        uint32_t row;
+        uint32_t index;
     };
 
+    // Deferred evaluation: buckets opened in the current window, swept when it closes
+    struct PendingSubflow {
+        char flowID[KEY_LEN];
+        array<uint32_t, STAGE2_ROWS> index;
+    };
+    bool deferEvaluation = false;
+    ArenaSpan<PendingSubflow> pending;
+    size_t pendingCount = 0;
+    size_t pendingOverflows = 0;
+
+    // Pre-aggregation: direct-mapped table of flows whose buckets all count the current window.
+    // Their later packets only bump the entry; the count is applied to the rows in one go when the
+    // entry is evicted or the window closes.
+    struct AggregateEntry {
+        char flowID[KEY_LEN];
+        array<uint32_t, STAGE2_ROWS> index;
+        uint32_t window = UINT32_MAX; // UINT32_MAX: empty entry
+        uint32_t count = 0;
+    };
+    bool preaggregate = false;
+    ArenaSpan<AggregateEntry> aggregates;
+    uint32_t aggregateBits = 0;
+    size_t aggregatedPackets = 0;
+    size_t aggregateFlushes = 0;
+
+    void installAggregate(AggregateEntry &entry, const char* flowID, const array<uint32_t, STAGE2_ROWS> &index,
+                          uint32_t currentWindow) {
+        if (entry.count > 0) {
+            flushAggregate(entry);
+        }
+        memcpy(entry.flowID, flowID, KEY_LEN);
+        entry.index = index;
+        entry.window = currentWindow;
+    }
+
+    void flushAggregate(AggregateEntry &entry) {
+        for (uint32_t f = 0; f < STAGE2_ROWS; ++f) {
+            Stage2Bucket scratch;
+            SelectedBucket selected{bindBucket(f, entry.index[f], scratch), f, entry.index[f]};
+            applyIncrements(selected.bucket, entry.window, entry.count);
+            commitBucket(selected);
+        }
+        entry.count = 0;
+        ++aggregateFlushes;
+    }
+
+    // count packets' worth of counter increments for an open window, with the same wrap and
+    // updateCKOnRebirth handling as one increment per packet
+    static void applyIncrements(Stage2Bucket* bucket, uint32_t window, uint32_t count) {
+        const uint8_t y = window % (SUBFLOW_WINDOWS + 1);
+        if (bucket->isCounterNull(y)) {
+            // The bucket lost the window (escape pool overflow); the first packet reopens it
+            bucket->initializeNewWindow(y, window);
+            --count;
+        }
+        while (count > 0) {
+            const uint32_t room = static_cast<uint32_t>(Stage2Bucket::COUNTER_MASK) - bucket->counter(y);
+            if (count <= room) {
+                bucket->addToCounter(y, count);
+                return;
+            }
+            bucket->addToCounter(y, room);
+            bucket->incrementCounter(y);  // Wraps to 0
+            count -= room + 1;
+            if (!updateCKOnRebirth(bucket, window)) {
+                bucket->reset();
+                bucket->initializeNewWindow(y, window);
+            }
+        }
+    }
+
+    void enqueuePending(const char* flowID, const array<uint32_t, STAGE2_ROWS> &index) {
+        if (pendingCount == pending.size()) {
+            // Table full: this flow is evaluated on the packet path when nextWindow opens
+            ++pendingOverflows;
+            return;
+        }
+        PendingSubflow &entry = pending[pendingCount++];
+        memcpy(entry.flowID, flowID, KEY_LEN);
+        entry.index = index;
+    }
+
+    uint64_t loadCell(size_t row, size_t index) const {
+        uint64_t cell = 0;
+        memcpy(&cell, &cells[row][index * DeltaStage2Cell::BYTES], DeltaStage2Cell::BYTES);
+        return cell;
+    }
+
+    void storeCell(size_t row, size_t index, uint64_t cell) {
+        memcpy(&cells[row][index * DeltaStage2Cell::BYTES], &cell, DeltaStage2Cell::BYTES);
+    }
+
+    uint32_t loadEpoch(size_t row, size_t index) const {
+        return (epochs[row][index >> 1] >> ((index & 1) * 4)) & Stage2Bucket::EPOCH_MASK;
+    }
+
+    void storeEpoch(size_t row, size_t index, uint32_t epoch) {
+        uint8_t &pair = epochs[row][index >> 1];
+        const uint32_t shift = (index & 1) * 4;
+        pair = static_cast<uint8_t>((pair & ~(Stage2Bucket::EPOCH_MASK << shift)) | (epoch << shift));
+    }
+
+    Stage2Bucket decodeCell(size_t row, size_t index, uint64_t cell) const {
+        Stage2Bucket bucket = DeltaStage2Cell::decode(cell);
+        if (aging && !bucket.empty()) {
+            bucket.word |= BucketWord(loadEpoch(row, index)) << Stage2Bucket::EPOCH_SHIFT;
+        }
+        return bucket;
+    }
+
+    // Bucket to operate on: in place for wide buckets and escaped cells, otherwise decoded into scratch
+    Stage2Bucket* bindBucket(uint32_t row, uint32_t index, Stage2Bucket &scratch) {
+        if (!deltaEncoding) {
+            return &buckets[row][index];
+        }
+        const uint64_t cell = loadCell(row, index);
+        if (DeltaStage2Cell::isEscaped(cell)) {
+            return &escapePool[DeltaStage2Cell::escapeIndex(cell)];
+        }
+        scratch = decodeCell(row, index, cell);
+        return &scratch;
+    }
+
+    // Common delta-encoded case: every row already counts the current window, so bump v(n-1) in place
+    bool incrementDeltaCells(const array<uint32_t, STAGE2_ROWS> &index, uint32_t currentWindow) {
+        const uint8_t y_current = currentWindow % (SUBFLOW_WINDOWS + 1);
+        array<uint64_t, STAGE2_ROWS> cell;
+        for (uint32_t f = 0; f < STAGE2_ROWS; ++f) {
+            // The newest slot may be left over from a run SUBFLOW_WINDOWS + 1 windows back
+            if (aging && loadEpoch(f, index[f]) != (currentWindow & Stage2Bucket::EPOCH_MASK)) {
+                return false;
+            }
+            cell[f] = loadCell(f, index[f]);
+            if (!DeltaStage2Cell::tryIncrementNewest(cell[f], y_current)) {
+                return false;
+            }
+        }
+        for (uint32_t f = 0; f < STAGE2_ROWS; ++f) {
+            storeCell(f, index[f], cell[f]);
+        }
+        return true;
+    }
+
+    // Write a bound bucket back: re-encode when possible, otherwise keep or move it to the escape pool
+    void commitBucket(const SelectedBucket &selected) {
+        if (!deltaEncoding) {
+            return;
+        }
+        const uint64_t old = loadCell(selected.row, selected.index);
+        uint64_t cell = 0;
+        if (DeltaStage2Cell::encode(*selected.bucket, cell)) {
+            if (DeltaStage2Cell::isEscaped(old)) {
+                freeEscapes.push_back(static_cast<uint32_t>(DeltaStage2Cell::escapeIndex(old)));
+            }
+            storeCell(selected.row, selected.index, cell);
+            if (aging) {
+                storeEpoch(selected.row, selected.index, selected.bucket->epoch());
+            }
+        } else if (!DeltaStage2Cell::isEscaped(old)) {
+            if (freeEscapes.empty()) {
+                // Pool exhausted: the bucket loses its history, as after a collision reset
+                ++escapeOverflows;
+                storeCell(selected.row, selected.index, 0);
+                return;
+            }
+            const uint32_t slot = freeEscapes.back();
+            freeEscapes.pop_back();
+            escapePool[slot] = *selected.bucket;
+            storeCell(selected.row, selected.index, DeltaStage2Cell::makeEscaped(slot));
+        }
+    }
+
     static inline bool isPowerOfTwo(uint32_t v) {
         return v && ((v & (v - 1)) == 0);
     }
@@ -139,52 +517,78 @@ private:
             return fastReduce(h, range);
         }
     }
-    static uint32_t calculateConsecutiveWindows(const Stage2Bucket &bucket, uint32_t currentWindow) {
-        const uint32_t R = SUBFLOW_WINDOWS + 1;
-        uint32_t count = 0;
-        for (uint32_t i = 1; i <= SUBFLOW_WINDOWS; ++i) {
-            if (currentWindow < i) break;
-            uint32_t window = currentWindow - i;
-            uint8_t y = window % R;
-            if (bucket.isCounterNull(y)) break;
-            count++;
+    // The ring holds the previous SUBFLOW_WINDOWS windows plus the current one, so a complete
+    // subflow ending at currentWindow - 1 means every slot except the current one is initialized
+    static bool hasCompleteSubflow(const Stage2Bucket &bucket, uint32_t currentWindow) {
+        constexpr uint32_t R = SUBFLOW_WINDOWS + 1;
+        constexpr uint32_t fullMask = (1u << R) - 1;
+        const uint32_t currentBit = 1u << (currentWindow % R);
+        return currentWindow >= SUBFLOW_WINDOWS && (bucket.flags() | currentBit) == fullMask;
+    }
+
+    // Stability decision on exact integer moments: variance <= threshold is evaluated as
+    // n * sum(x^2) - sum(x)^2 <= threshold * n * (n - 1), for direct and offset counters in one pass.
+    // Gives the same decisions as the float two-pass min(varDirect, varOffset) for COUNTER_BITS = 8;
+    // for wider counters it is exact where the float variance rounds. The moments are 64-bit once
+    // n^2 * max(x)^2 no longer fits in 32 bits (16-bit counters).
+    static bool isStableSubflow(const Stage2Bucket &bucket, uint32_t startWindow) {
+        constexpr uint32_t R = SUBFLOW_WINDOWS + 1;
+        constexpr uint32_t half = (1u << COUNTER_BITS) >> 1;
+        constexpr uint64_t n = SUBFLOW_WINDOWS;
+        static_assert(n >= 2, "variance needs at least two windows");
+        using Moment = conditional_t<(n * n * Stage2Bucket::COUNTER_MASK * Stage2Bucket::COUNTER_MASK <= UINT32_MAX),
+                                     uint32_t, uint64_t>;
+        Moment sum = 0, sumSq = 0, offsetSum = 0, offsetSumSq = 0;
+
+        for (uint32_t i = 0; i < SUBFLOW_WINDOWS; ++i) {
+            Moment v = bucket.counter((startWindow + i) % R);
+            Moment adj = v ^ half;  // (v + half) % base
+            sum += v;
+            sumSq += v * v;
+            offsetSum += adj;
+            offsetSumSq += adj * adj;
         }
-        return count;
+
+        const float limit = STABLE_THRESHOLD * static_cast<float>(n * (n - 1));
+        return static_cast<float>(Moment(n) * sumSq - sum * sum) <= limit ||
+               static_cast<float>(Moment(n) * offsetSumSq - offsetSum * offsetSum) <= limit;
     }
 
-    static float calculateVariance(const vector<float> &data) {
-        if (data.size() < 2) {
+    // Fixed-size sample buffer: a subflow never spans more than SUBFLOW_WINDOWS windows
+    using WindowSamples = array<float, SUBFLOW_WINDOWS>;
+
+    static float calculateVariance(const float *data, size_t n) {
+        if (n < 2) {
             return numeric_limits<float>::infinity();
         }
 
-        float sum = accumulate(data.begin(), data.end(), 0.0f);
-        float mean = sum / data.size();
+        float sum = accumulate(data, data + n, 0.0f);
+        float mean = sum / n;
 
         float variance = 0.0f;
-        for (float val: data) {
-            variance += (val - mean) * (val - mean);
+        for (size_t i = 0; i < n; ++i) {
+            variance += (data[i] - mean) * (data[i] - mean);
         }
-        return variance / (data.size() - 1);
+        return variance / (n - 1);
     }
 
     static float calculateDirectVariance(const Stage2Bucket &bucket, uint32_t startWindow) {
         const uint32_t R = SUBFLOW_WINDOWS + 1;
-        vector<float> directFreqs;
-        directFreqs.reserve(SUBFLOW_WINDOWS);
+        WindowSamples directFreqs;
+        size_t n = 0;
 
         for (uint32_t i = 0; i < SUBFLOW_WINDOWS; ++i) {
             uint32_t windowIndex = (startWindow + i) % R;
             if (bucket.isCounterNull(static_cast<uint8_t>(windowIndex))) {
                 return numeric_limits<float>::infinity();
             }
-            uint8_t counter = bucket.cx[windowIndex];
-            directFreqs.push_back(static_cast<float>(counter));
+            directFreqs[n++] = static_cast<float>(bucket.counter(windowIndex));
         }
 
-        if (directFreqs.size() < 2) {
+        if (n < 2) {
             return numeric_limits<float>::infinity();
         }
-        return calculateVariance(directFreqs);
+        return calculateVariance(directFreqs.data(), n);
     }
 
     // Calculate offset variance to handle counter wrap-around
@@ -192,21 +596,21 @@ private:
         const uint32_t R = SUBFLOW_WINDOWS + 1;
         const uint32_t base = (1u << COUNTER_BITS);
         const uint32_t half = base >> 1;
-        vector<float> offsetFreqs;
-        offsetFreqs.reserve(SUBFLOW_WINDOWS);
+        WindowSamples offsetFreqs;
+        size_t n = 0;
 
         for (uint32_t i = 0; i < SUBFLOW_WINDOWS; ++i) {
             uint32_t windowIndex = (startWindow + i) % R;
             if (bucket.isCounterNull(static_cast<uint8_t>(windowIndex))) break;
-            uint32_t v = bucket.cx[windowIndex];
+            uint32_t v = bucket.counter(windowIndex);
             uint32_t adj = (v + half) % base;  // Offset adjustment for wrap-around
-            offsetFreqs.push_back(static_cast<float>(adj));
+            offsetFreqs[n++] = static_cast<float>(adj);
         }
         
-        if (offsetFreqs.size() < 2) {
+        if (n < 2) {
             return numeric_limits<float>::infinity();
         }
-        return calculateVariance(offsetFreqs);
+        return calculateVariance(offsetFreqs.data(), n);
     }
 
     static float calculateMeanFrequency(const Stage2Bucket &bucket, uint32_t startWindow) {
@@ -219,118 +623,456 @@ private:
             if (bucket.isCounterNull(static_cast<uint8_t>(windowIndex))) {
                 return numeric_limits<float>::infinity();
             }
-            sum += static_cast<float>(bucket.cx[windowIndex]);
+            sum += static_cast<float>(bucket.counter(windowIndex));
             count++;
         }
 
         return count > 0 ? sum / count : 0.0f;
     }
 
-    // Update CK fields on counter rebirth: increment current CK, decrement previous CK
-    static bool updateCKOnRebirth(Stage2Bucket* bucket, uint32_t absoluteWindow) {
-        bool useCk1 = (absoluteWindow % 2 == 0);
+    // Hand the complete subflow ending at currentWindow - 1 to Stage3 if it is stable
+    bool emitStableSubflow(const Stage2Bucket &bucket, const char* flowID, uint32_t currentWindow) {
+        uint32_t w = currentWindow - SUBFLOW_WINDOWS;
+        // The float statistics are only computed once the integer decision passes
+        if (!isStableSubflow(bucket, w)) {
+            return false;
+        }
+        // Mean and minimum of direct and offset variance
+        float meanFreq = calculateMeanFrequency(bucket, w);
+        float varDirect = calculateDirectVariance(bucket, w);
+        float varOffset = calculateOffsetVariance(bucket, w);
+        float variance = min(varDirect, varOffset);
 
-        if (useCk1) {
-            if (!bucket->ck1_is_null && bucket->ck1 < 6) {
-                bucket->ck1++;  // Increment ck1 on rebirth
-            }
-            uint32_t windowNum = bucket->countWindowNumber();
-            if (windowNum != 1){
-                if (!bucket->ck2_is_null) {
-                    if (bucket->ck2 != 0) {
-                        bucket->ck2--;  // Decrement ck2 from previous window
-                    } else {
-                        bucket->ck2_is_null = true;
-                        return false;
-                    }
-                }
-                else{
-                    return false;
-                }
+        stage3.processSteadySubflow(flowID, w, variance, meanFreq);
+        PLACID_STAT(stage2, subflowsEmitted);
+        PLACID_PROBE4(stage2_emit, flowID, w, traceMilli(meanFreq), traceMilli(variance));
+        return true;
+    }
+
+    // checkStability comparisons between cx1 = cx[y_prev] and cx2 = cx[y_prev_prev]
+    enum StabilityCompare : uint8_t {
+        CMP_NONE = 0,          // No check: the transition is decided by the window flags alone
+        CMP_SAME_EPOCH = 1,    // |cx2 - cx1|
+        CMP_PREV_REBORN = 2,   // cx1 + base - cx2
+        CMP_PREV_PREV_REBORN = 3 // cx2 + base - cx1
+    };
+
+    struct Transition {
+        uint8_t compare;
+        bool resetAlways;
+    };
+
+    // Transition of a bucket whose current window is null, indexed by
+    // (windowNum > 2, y_prev null, y_prev_prev null, CK parity, CK code).
+    // Mirrors the reference ladder in advanceNullBucketLadder.
+    static constexpr array<Transition, 128> buildTransitionTable() {
+        array<Transition, 128> table{};
+        for (uint32_t index = 0; index < 128; ++index) {
+            const bool manyWindows = (index >> 6) & 1;
+            const bool prevNull = (index >> 5) & 1;
+            const bool prevPrevNull = (index >> 4) & 1;
+            const bool useCk1 = (index >> 3) & 1;
+            const uint32_t code = index & 7;
+            const uint32_t ck = (code + 1) & 7;
+
+            if (!manyWindows) {
+                table[index] = Transition{CMP_NONE, prevNull};
+            } else if (prevNull || prevPrevNull || code == Stage2Bucket::CK_NULL_CODE || ck > 2) {
+                table[index] = Transition{CMP_NONE, true};
+            } else if (ck == 2) {
+                table[index] = Transition{CMP_PREV_REBORN, false};
+            } else if (ck == 1) {
+                table[index] = Transition{CMP_SAME_EPOCH, false};
+            } else {
+                table[index] = Transition{useCk1 ? CMP_PREV_PREV_REBORN : CMP_PREV_REBORN, false};
             }
+        }
+        return table;
+    }
 
-        } else {
-            if (!bucket->ck2_is_null && bucket->ck2 < 6) {
-                bucket->ck2++;
+    static Transition transitionFor(const Stage2Bucket &b, uint32_t currentWindow, uint8_t y_prev, uint8_t y_prev_prev) {
+        static constexpr array<Transition, 128> transitionTable = buildTransitionTable();
+        const bool useCk1 = (currentWindow % 2 == 0);
+        const uint32_t index = (static_cast<uint32_t>(b.countWindowNumber() > 2) << 6) |
+                               (static_cast<uint32_t>(b.isCounterNull(y_prev)) << 5) |
+                               (static_cast<uint32_t>(b.isCounterNull(y_prev_prev)) << 4) |
+                               (static_cast<uint32_t>(useCk1) << 3) |
+                               static_cast<uint32_t>((b.word >> Stage2Bucket::ckShift(useCk1)) & 7);
+        return transitionTable[index];
+    }
+
+    // checkStability for a table entry, with the comparison picked by index instead of by branch
+    static bool passesStability(const Stage2Bucket &b, Transition t, uint8_t y_prev, uint8_t y_prev_prev) {
+        const uint32_t base = (1u << COUNTER_BITS);
+        const uint32_t cx1 = b.counter(y_prev);
+        const uint32_t cx2 = b.counter(y_prev_prev);
+        const uint32_t distance[4] = {UINT32_MAX, static_cast<uint32_t>(abs(int(cx2) - int(cx1))),
+                                      cx1 + base - cx2, cx2 + base - cx1};
+        return distance[t.compare] <= ALPHA_THRESHOLD;
+    }
+
+    // Table-driven null-bucket transition: the only data-dependent branch left is subflow emission
+    void advanceNullBucketByTable(Stage2Bucket *b, const char* flowID, uint32_t currentWindow,
+                                  uint8_t y_current, uint8_t y_prev, uint8_t y_prev_prev, bool &havepassed) {
+        const Transition t = transitionFor(*b, currentWindow, y_prev, y_prev_prev);
+        const bool stable = passesStability(*b, t, y_prev, y_prev_prev);
+        const bool complete = stable && hasCompleteSubflow(*b, currentWindow);
+        if (t.compare != CMP_NONE && !stable) {
+            PLACID_STAT(stage2, stabilityRejections);
+        }
+
+        if (complete && !havepassed) {
+            havepassed = emitStableSubflow(*b, flowID, currentWindow);
+        }
+        const bool reset = t.resetAlways | (t.compare != CMP_NONE && (!stable || complete));
+        b->word = reset ? 0 : b->word;
+        b->initializeNewWindow(y_current, currentWindow);
+    }
+
+    // Deferred evaluation: the stability check, emission and reset that the first packet of
+    // nextWindow would run for a bucket, without opening nextWindow. Transitions decided by the
+    // window flags alone stay on the packet path, where they cost a table lookup.
+    void evaluateClosedBucket(Stage2Bucket *b, const char* flowID, uint32_t nextWindow,
+                              uint8_t y_next, uint8_t y_prev, uint8_t y_prev_prev, bool &havepassed) {
+        if (!b->isCounterNull(y_next)) {
+            return;
+        }
+        const Transition t = transitionFor(*b, nextWindow, y_prev, y_prev_prev);
+        if (t.compare == CMP_NONE) {
+            return;
+        }
+        const bool stable = passesStability(*b, t, y_prev, y_prev_prev);
+        const bool complete = stable && hasCompleteSubflow(*b, nextWindow);
+        if (!stable) {
+            PLACID_STAT(stage2, stabilityRejections);
+        }
+
+        if (complete && !havepassed) {
+            havepassed = emitStableSubflow(*b, flowID, nextWindow);
+        }
+        if (!stable || complete) {
+            b->reset();
+        }
+    }
+
+    // Reference if/else ladder for a bucket whose current window is null
+    void advanceNullBucketLadder(Stage2Bucket *b, const char* flowID, uint32_t currentWindow,
+                                 uint8_t y_current, uint8_t y_prev, uint8_t y_prev_prev, bool &havepassed) {
+        uint32_t windowNum = b->countWindowNumber();
+        if (windowNum > 2 && (b->isCounterNull(y_prev) || b->isCounterNull(y_prev_prev))) {
+            b->reset();
+            b->initializeNewWindow(y_current, currentWindow);
+        }
+        else if (windowNum <= 2 && b->isCounterNull(y_prev) ){
+            b->reset();
+            b->initializeNewWindow(y_current, currentWindow);
+        }
+        else if (windowNum <= 2 && !b->isCounterNull(y_prev) ){
+            b->initializeNewWindow(y_current, currentWindow);
+        }
+        else {
+            // Check stability using relative rebirth algorithm
+            if (!b->checkStability(y_prev, y_prev_prev, currentWindow)) {
+                PLACID_STAT(stage2, stabilityRejections);
+                b->reset();
+
+                b->initializeNewWindow(y_current, currentWindow);
             }
-            uint32_t windowNum = bucket->countWindowNumber();
-            if (windowNum != 1){
-                if (!bucket->ck1_is_null) {
-                    if (bucket->ck1 != 0) {
-                        bucket->ck1--;
-                    } else {
-                        bucket->ck1_is_null = true;
-                        return false;
+            else {
+                if (hasCompleteSubflow(*b, currentWindow)) {
+                    if (!havepassed) {
+                        havepassed = emitStableSubflow(*b, flowID, currentWindow);
                     }
+
+                    b->reset();
+                    b->initializeNewWindow(y_current, currentWindow);
                 }
-                else{
-                    return false;
+                else {
+                    b->initializeNewWindow(y_current, currentWindow);
                 }
             }
+        }
+    }
+
+    // Update CK fields on counter rebirth: increment current CK, decrement previous CK
+    static bool updateCKOnRebirth(Stage2Bucket* bucket, uint32_t absoluteWindow) {
+        bool useCk1 = (absoluteWindow % 2 == 0);
+        PLACID_STAT(stage2, rebirths);
 
+        if (!bucket->ckIsNull(useCk1) && bucket->ck(useCk1) < 6) {
+            bucket->setCk(useCk1, bucket->ck(useCk1) + 1);  // Increment current CK on rebirth
+        }
+        uint32_t windowNum = bucket->countWindowNumber();
+        if (windowNum != 1) {
+            if (bucket->ckIsNull(!useCk1)) {
+                PLACID_STAT(stage2, ckUpdateFailures);
+                return false;
+            }
+            if (bucket->ck(!useCk1) == 0) {
+                bucket->setCkNull(!useCk1);
+                PLACID_STAT(stage2, ckUpdateFailures);
+                return false;
+            }
+            bucket->setCk(!useCk1, bucket->ck(!useCk1) - 1);  // Decrement CK from previous window
         }
         return true;
     }
 
 public:
-    explicit Stage2Monitor(Stage3Merger &s3, size_t memoryBytes = STAGE2_MEMORY_BYTES) : hashSeed(0x200), stage3(s3) {
+    explicit Stage2Monitor(Stage3Merger &s3, size_t memoryBytes = STAGE2_MEMORY_BYTES,
+                           bool useDeltaEncoding = STAGE2_DELTA_ENCODING,
+                           bool useDeferredEvaluation = STAGE2_DEFERRED_EVALUATION,
+                           bool useAging = STAGE2_AGING,
+                           bool usePreaggregation = STAGE2_PREAGGREGATION,
+                           TableArena* arena = nullptr)
+        : hashSeed(0x200), stage3(s3), deltaEncoding(useDeltaEncoding), aging(useAging),
+          deferEvaluation(useDeferredEvaluation), preaggregate(usePreaggregation) {
         rows = STAGE2_ROWS;
-        size_t bucketSize = sizeof(Stage2Bucket);
-        size_t perRowBytes = (rows > 0) ? (memoryBytes / rows) : 0;
-        bucketsPerRow = (bucketSize > 0) ? max<size_t>(1, perRowBytes / bucketSize) : 1;
-
-        buckets.resize(rows);
-        for (size_t i = 0; i < rows; ++i) {
-            buckets[i].resize(bucketsPerRow);
+        // Tables come from the given arena, or from one of its own; all-zero words and cells are empty
+        TableArena& tables = arena ? *arena : ownTables;
+        tables.reserve(memoryBytes + TABLE_ARENA_EXTRA_BYTES);
+        if (preaggregate) {
+            aggregateBits = slotBitsFor(STAGE2_PREAGG_ENTRIES);
+            aggregates = tables.allocate(size_t(1) << aggregateBits, AggregateEntry());
         }
-        rowSeeds.resize(rows);
+        if (deferEvaluation) {
+            pending = tables.allocate<PendingSubflow>(STAGE2_PENDING_CAPACITY);
+        }
+        if (!deltaEncoding) {
+            size_t bucketSize = sizeof(Stage2Bucket);
+            size_t perRowBytes = (rows > 0) ? (memoryBytes / rows) : 0;
+            bucketsPerRow = (bucketSize > 0) ? max<size_t>(1, perRowBytes / bucketSize) : 1;
 
+            for (auto& row : buckets) {
+                row = tables.allocate<Stage2Bucket>(bucketsPerRow);
+            }
+        } else {
+            // Escape pool entries cost a wide bucket plus a free-list slot
+            size_t poolBytes = static_cast<size_t>(memoryBytes * STAGE2_DELTA_ESCAPE_RATIO);
+            size_t poolSize = max<size_t>(1, poolBytes / (sizeof(Stage2Bucket) + sizeof(uint32_t)));
+            size_t perRowBytes = (rows > 0) ? ((memoryBytes - min(poolBytes, memoryBytes)) / rows) : 0;
+            // With aging, each cell also takes half a byte of the epoch plane
+            bucketsPerRow = max<size_t>(1, aging ? perRowBytes * 2 / (DeltaStage2Cell::BYTES * 2 + 1)
+                                                 : perRowBytes / DeltaStage2Cell::BYTES);
+
+            for (auto& row : cells) {
+                row = tables.allocate<uint8_t>(bucketsPerRow * DeltaStage2Cell::BYTES);
+            }
+            if (aging) {
+                for (auto& row : epochs) {
+                    row = tables.allocate<uint8_t>((bucketsPerRow + 1) / 2);
+                }
+            }
+            escapePool = tables.allocate<Stage2Bucket>(poolSize);
+            freeEscapes.reserve(poolSize);
+            for (size_t i = poolSize; i > 0; --i) {
+                freeEscapes.push_back(static_cast<uint32_t>(i - 1));
+            }
+        }
         for (size_t i = 0; i < rows; ++i) {
             rowSeeds[i] = hashSeed + static_cast<uint32_t>(i);
         }
     }
 
+    size_t width() const { return bucketsPerRow; }
+
+    Stage2Bucket bucketAt(size_t row, size_t index) const {
+        if (!deltaEncoding) {
+            return buckets[row][index];
+        }
+        const uint64_t cell = loadCell(row, index);
+        return DeltaStage2Cell::isEscaped(cell) ? escapePool[DeltaStage2Cell::escapeIndex(cell)]
+                                                : decodeCell(row, index, cell);
+    }
+
+    // Delta encoding: wide buckets in use out of the escape pool, and escapes dropped for lack of space
+    size_t escapedBuckets() const { return escapePool.size() - freeEscapes.size(); }
+    size_t escapePoolOverflows() const { return escapeOverflows; }
+
+    // Deferred evaluation: flows that did not fit in the pending table and were evaluated inline
+    size_t pendingTableOverflows() const { return pendingOverflows; }
+
+    // Pre-aggregation: packets absorbed by the table, and bulk updates written to the rows
+    size_t preaggregatedPackets() const { return aggregatedPackets; }
+    size_t preaggregateFlushes() const { return aggregateFlushes; }
+
+    // Apply every pending pre-aggregated count; closeWindow does this before anything else
+    void flushAggregates() {
+        for (auto &entry : aggregates) {
+            if (entry.count > 0) {
+                flushAggregate(entry);
+            }
+            entry.window = UINT32_MAX;
+        }
+    }
+
+    // Aging: the last sweep slice, and aged buckets found on the packet path before the sweep got to them
+    Stage2AgingSample agingSample() const { return lastSample; }
+    size_t lazilyAgedBuckets() const { return lazilyAged; }
+
+    // Called once per window change, before the first packet of nextWindow; closingWindow is the window
+    // the last packets were in, which may be several windows back when windows went by without packets.
+    // With deferred evaluation, runs the stability checks and subflow emission for every bucket opened
+    // in the closing window in one sweep, instead of on the first packet of each flow in nextWindow.
+    // With aging, also advances the aging sweep by one slice per window passed, at most a full pass.
+    // Pre-aggregated counts are flushed first.
+    void closeWindow(uint32_t closingWindow, uint32_t nextWindow) {
+        flushAggregates();
+        if (deferEvaluation) {
+            evaluatePending(nextWindow);
+        }
+        if (aging) {
+            sweepAgedBuckets(closingWindow, nextWindow);
+        }
+    }
+
+    // TableDriven selects the transition table for buckets whose current window is null;
+    // false runs the reference if/else ladder, kept for differential testing
+    template <bool TableDriven = STAGE2_TRANSITION_TABLE>
     void processPotentialFlow(const char* flowID, uint32_t currentWindow) {
+        // One bucket per row; fixed-size so the per-packet path never touches the allocator
+        array<SelectedBucket, STAGE2_ROWS> selected;
+        array<Stage2Bucket, STAGE2_ROWS> scratch;
+
+        array<uint32_t, STAGE2_ROWS> index;
+
+        AggregateEntry* aggregate = nullptr;
+        if (preaggregate) {
+            aggregate = &aggregates[keySlot(flowID, aggregateBits)];
+            if (aggregate->window == currentWindow && memcmp(aggregate->flowID, flowID, KEY_LEN) == 0) {
+                ++aggregate->count;
+                ++aggregatedPackets;
+                return;
+            }
+        }
+
+        for (uint32_t f = 0; f < STAGE2_ROWS; ++f) {
+            index[f] = indexForRow(flowID, f, static_cast<uint32_t>(bucketsPerRow));
+        }
+        if (deltaEncoding && incrementDeltaCells(index, currentWindow)) {
+            if (aggregate) {
+                installAggregate(*aggregate, flowID, index, currentWindow);
+            }
+            return;
+        }
+        for (uint32_t f = 0; f < STAGE2_ROWS; ++f) {
+            selected[f] = SelectedBucket{bindBucket(f, index[f], scratch[f]), f, index[f]};
+        }
+        if (aging) {
+            for (auto &SelectBucket : selected) {
+                if (SelectBucket.bucket->isAged(currentWindow)) {
+                    SelectBucket.bucket->reset();
+                    ++lazilyAged;
+                }
+            }
+        }
+
+        const bool opened = advanceBuckets<TableDriven>(selected, flowID, currentWindow);
+
+        // Later packets of the window can be pre-aggregated once every row counts it
+        BucketWord commonWord = ~BucketWord(0);
+        for (auto &SelectBucket : selected) {
+            commonWord &= SelectBucket.bucket->word;
+            commitBucket(SelectBucket);
+        }
+        if (aggregate && (commonWord & (BucketWord(1) << (Stage2Bucket::FLAGS_SHIFT + currentWindow % (SUBFLOW_WINDOWS + 1))))) {
+            installAggregate(*aggregate, flowID, index, currentWindow);
+        }
+        if (opened && deferEvaluation) {
+            enqueuePending(flowID, index);
+        }
+    }
+
+private:
+    // Deferred evaluation for every flow that opened the closing window
+    void evaluatePending(uint32_t nextWindow) {
         const uint32_t R = SUBFLOW_WINDOWS + 1;
-        const uint8_t y_current = currentWindow % R;
-        const uint8_t y_prev = (currentWindow - 1) % R;
-        const uint8_t y_prev_prev = (currentWindow - 2) % R;
+        const uint8_t y_next = nextWindow % R;
+        const uint8_t y_prev = (nextWindow - 1) % R;
+        const uint8_t y_prev_prev = (nextWindow - 2) % R;
 
-        vector<SelectedBucket> selected;
+        for (size_t e = 0; e < pendingCount; ++e) {
+            const PendingSubflow &entry = pending[e];
+            bool havepassed = false;
+            for (uint32_t f = 0; f < STAGE2_ROWS; ++f) {
+                Stage2Bucket scratch;
+                SelectedBucket selected{bindBucket(f, entry.index[f], scratch), f, entry.index[f]};
+                evaluateClosedBucket(selected.bucket, entry.flowID, nextWindow, y_next, y_prev, y_prev_prev, havepassed);
+                commitBucket(selected);
+            }
+        }
+        pendingCount = 0;
+    }
 
-        for (uint32_t f = 0; f < rows; ++f) {
-            uint32_t k = indexForRow(flowID, f, static_cast<uint32_t>(bucketsPerRow));
-            Stage2Bucket* cell = &buckets[f][k];
-            selected.push_back(SelectedBucket{cell});
+    // Visit the next slices of the table, one per window passed, and reset the buckets that aged out. A
+    // bucket is visited within every STAGE2_AGING_SWEEP_PERIOD windows, so its epoch tag is cleared before
+    // it can alias. Idle time is read at closingWindow, where the tags are still exact, plus the gap:
+    // after a jump of 16 windows or more, nextWindow alone would alias.
+    void sweepAgedBuckets(uint32_t closingWindow, uint32_t nextWindow) {
+        const size_t tableBuckets = rows * bucketsPerRow;
+        const uint32_t gap = nextWindow - closingWindow;
+        const size_t slices = min<size_t>(gap, STAGE2_AGING_SWEEP_PERIOD);
+        const size_t visits = min(tableBuckets, slices * ((tableBuckets + STAGE2_AGING_SWEEP_PERIOD - 1) /
+                                                          STAGE2_AGING_SWEEP_PERIOD));
+        Stage2AgingSample sample;
+        sample.window = nextWindow;
+        sample.visited = visits;
+        for (size_t i = 0; i < visits; ++i) {
+            Stage2Bucket scratch;
+            SelectedBucket selected{bindBucket(static_cast<uint32_t>(sweepRow), static_cast<uint32_t>(sweepIndex), scratch),
+                                    static_cast<uint32_t>(sweepRow), static_cast<uint32_t>(sweepIndex)};
+            if (!selected.bucket->empty() && selected.bucket->idleWindows(closingWindow) + gap > SUBFLOW_WINDOWS) {
+                selected.bucket->reset();
+                commitBucket(selected);
+                ++sample.aged;
+            } else if (!selected.bucket->empty()) {
+                ++sample.live;
+            }
+            if (++sweepIndex == bucketsPerRow) {
+                sweepIndex = 0;
+                sweepRow = (sweepRow + 1) % rows;
+            }
         }
+        lastSample = sample;
+    }
 
+    // Returns true when the packet opened the current window in at least one row
+    template <bool TableDriven>
+    bool advanceBuckets(array<SelectedBucket, STAGE2_ROWS> &selected, const char* flowID, uint32_t currentWindow) {
+        const uint32_t R = SUBFLOW_WINDOWS + 1;
+        const uint8_t y_current = currentWindow % R;
+        const uint8_t y_prev = (currentWindow - 1) % R;
+        const uint8_t y_prev_prev = (currentWindow - 2) % R;
+
+        // Null checks as word operations: AND of all flag fields has the current bit only if no row is null
         bool hasEmpty = false;
-        bool hasCurrentNull = false;
+        BucketWord commonWord = ~BucketWord(0);
 
         for (auto& SelectBucket : selected) {
-            if (!hasEmpty && SelectBucket.bucket->empty()) {
-                hasEmpty = true;
-            }
-            if (!hasCurrentNull && SelectBucket.bucket->isCounterNull(y_current)) {
-                hasCurrentNull = true;
-            }
+            hasEmpty |= SelectBucket.bucket->empty();
+            commonWord &= SelectBucket.bucket->word;
         }
+        const bool hasCurrentNull = !(commonWord & (BucketWord(1) << (Stage2Bucket::FLAGS_SHIFT + y_current)));
         if (hasEmpty) {
+            // The close sweep of deferred evaluation can reset one of a flow's rows and keep another: the
+            // kept row is opened in this same pass, as inline evaluation would open both on this packet
+            bool havepassed = false;
             for (auto& SelectBucket : selected) {
-                if (SelectBucket.bucket->empty()) {
-                    SelectBucket.bucket->initializeNewWindow(y_current, currentWindow);
+                Stage2Bucket* bucketPtr = SelectBucket.bucket;
+                if (bucketPtr->empty()) {
+                    bucketPtr->initializeNewWindow(y_current, currentWindow);
+                } else if (deferEvaluation && bucketPtr->isCounterNull(y_current)) {
+                    advanceNullBucket<TableDriven>(bucketPtr, flowID, currentWindow, y_current, y_prev, y_prev_prev,
+                                                   havepassed);
                 }
             }
-            return;
+            return true;
         }
 
         if (!hasCurrentNull) {
             for (auto& SelectBucket : selected) {
                 Stage2Bucket* bucketPtr = SelectBucket.bucket;
-                if (bucketPtr->cx[y_current] < ((1u << COUNTER_BITS) - 1)) {
-                    bucketPtr->cx[y_current]++;
-                } else {
-                    bucketPtr->cx[y_current] = 0;
+                if (!bucketPtr->incrementCounter(y_current)) {
                     bool flag5 = updateCKOnRebirth(bucketPtr, currentWindow);
                     if (!flag5) {
                         bucketPtr->reset();
@@ -338,66 +1080,34 @@ public:
                     }
                 }
             }
-            return;
+            return false;
         }
-        vector<Stage2Bucket*> nullBuckets;
+        array<Stage2Bucket*, STAGE2_ROWS> nullBuckets;
+        size_t nullCount = 0;
         for (auto &SelectedBucket : selected) {
             if (SelectedBucket.bucket->isCounterNull(y_current)) {
-                nullBuckets.push_back(SelectedBucket.bucket);
+                nullBuckets[nullCount++] = SelectedBucket.bucket;
             }
         }
-        if (nullBuckets.empty()) return;
+        if (nullCount == 0) return false;
 
         bool havepassed = false;
 
-        for (auto *b : nullBuckets) {
-            uint32_t windowNum = b->countWindowNumber();
-            if (windowNum > 2 && (b->isCounterNull(y_prev) || b->isCounterNull(y_prev_prev))) {
-                b->reset();
-                b->initializeNewWindow(y_current, currentWindow);
-            }
-            else if (windowNum <= 2 && b->isCounterNull(y_prev) ){
-                b->reset();
-                b->initializeNewWindow(y_current, currentWindow);
-            }
-            else if (windowNum <= 2 && !b->isCounterNull(y_prev) ){
-                b->initializeNewWindow(y_current, currentWindow);
-            }
-            else {
-                // Check stability using relative rebirth algorithm
-                if (!b->checkStability(y_prev, y_prev_prev, currentWindow)) {
-                    b->reset();
+        for (size_t n = 0; n < nullCount; ++n) {
+            advanceNullBucket<TableDriven>(nullBuckets[n], flowID, currentWindow, y_current, y_prev, y_prev_prev,
+                                           havepassed);
+        }
+        return true;
+    }
 
-                    b->initializeNewWindow(y_current, currentWindow);
-                }
-                else {
-                    uint32_t consecutiveWindows = calculateConsecutiveWindows(*b, currentWindow);
-                    if (consecutiveWindows == SUBFLOW_WINDOWS) {
-                        if(!havepassed){
-                            // Calculate mean and variance, use minimum of direct and offset variance
-                            uint32_t w = currentWindow - SUBFLOW_WINDOWS;
-                            float meanFreq = calculateMeanFrequency(*b, w);
-                            float varDirect = calculateDirectVariance(*b, w);
-                            float varOffset = calculateOffsetVariance(*b, w);
-                            float variance = min(varDirect, varOffset);
-                            
-                            // Pass stable subflow to Stage3 if variance is below threshold
-                            if (variance <= STABLE_THRESHOLD) {
-                                stage3.processSteadySubflow(flowID, w, meanFreq, variance);
-                                havepassed = true;
-                            }
-                        }
-
-                        b->reset();
-                        b->initializeNewWindow(y_current, currentWindow);
-                    }
-                    else {
-                        b->initializeNewWindow(y_current, currentWindow);
-                    }
-                }
-            }
+    template <bool TableDriven>
+    void advanceNullBucket(Stage2Bucket *b, const char* flowID, uint32_t currentWindow,
+                           uint8_t y_current, uint8_t y_prev, uint8_t y_prev_prev, bool &havepassed) {
+        if (TableDriven) {
+            advanceNullBucketByTable(b, flowID, currentWindow, y_current, y_prev, y_prev_prev, havepassed);
+        } else {
+            advanceNullBucketLadder(b, flowID, currentWindow, y_current, y_prev, y_prev_prev, havepassed);
         }
-        return;
     }
 };
 #endif
\ No newline at end of file
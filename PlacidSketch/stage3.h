@@ -3,8 +3,14 @@
 using namespace std;
 #include "parm.h"
 #include "MurmurHash3.h"
+#include "stats.h"
+#include "TableArena.h"
+#include "trace.h"
+#include <algorithm>
+#include <array>
 #include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
 // Statistics structure: stores mean frequency and frequency variance of stable flows
@@ -15,12 +21,38 @@ struct Statistics {
     Statistics(float m, float v) : mean(m), variance(v) {}
 };
 
-// Stage3Cell: stores merged information of a stable flow
-struct Stage3Cell {
+// A stable flow reported by Stage3: at least Q merged subflows from startWindow to endWindow (inclusive)
+struct StableFlowReport {
+    char ID[KEY_LEN];
+    uint32_t startWindow;
+    uint32_t endWindow;
+    uint32_t subflows;
+    float mean;
+    float variance;
+};
+
+// Live answer for one flow, read while ingestion runs: whether a Stage3 cell tracks it, and whether
+// that cell already qualifies as a stable flow (would be reported if it closed now)
+struct FlowStability {
+    bool tracked = false;
+    bool stable = false;
+    uint32_t startWindow = 0;
+    uint32_t endWindow = 0;  // Last window of the merged subflows
+    uint32_t subflows = 0;
+    float mean = 0.0f;
+    float variance = 0.0f;
+};
+
+// Stage3Cell: stores merged information of a stable flow. Aligned to 8 bytes so that concurrent
+// readers and the ingest thread can move it as four atomic 64-bit words.
+struct alignas(8) Stage3Cell {
     char ID[KEY_LEN]{};
     uint16_t window = 0;
     Statistics s;
     uint16_t number = 0;
+    // Seqlock sequence for concurrent readers, odd while the ingest thread rewrites the cell. It sits
+    // in what was padding, and clear() leaves it alone.
+    uint16_t sequence = 0;
 
     bool empty() const { return ID[0] == 0; }
     void clear() {
@@ -31,15 +63,234 @@ struct Stage3Cell {
     }
 };
 
+// Ranking of Stage3 cells, kept up to date as cells change: a binary min-heap of entries
+// rank << 32 | cell index, plus each cell's slot in it, so that a cell whose rank changes is sifted in
+// place. Lower ranks come first, and equal ranks go to the lower cell index. Both tables start zeroed:
+// position holds slot + 1, and 0 for a cell that is not in the heap.
+struct CellHeap {
+    ArenaSpan<uint64_t> heap;
+    ArenaSpan<uint32_t> position;
+    uint32_t count = 0;
+
+    static uint64_t entry(uint32_t cell, uint32_t rank) { return static_cast<uint64_t>(rank) << 32 | cell; }
+    static uint32_t cellOf(uint64_t entry) { return static_cast<uint32_t>(entry); }
+
+    // Inserts, removes or re-sifts cell after it changed
+    void update(uint32_t cell, bool member, uint32_t rank) {
+        const uint32_t slot = position[cell];
+        if (slot == 0) {
+            if (member) siftUp(count++, entry(cell, rank));
+        } else if (!member) {
+            remove(slot - 1);
+        } else {
+            siftUp(slot - 1, entry(cell, rank));
+            siftDown(position[cell] - 1, entry(cell, rank));
+        }
+    }
+
+    // Visits the first k cells in order without touching the heap: the next one is always the best
+    // slot of a frontier that starts at the root and gains the children of each visited slot
+    template <class Visit>
+    void top(size_t k, Visit visit) const {
+        auto worse = [this](uint32_t x, uint32_t y) { return heap[x] > heap[y]; };
+        vector<uint32_t> frontier;
+        frontier.reserve(k + 1);
+        if (count > 0) frontier.push_back(0);
+        for (; k > 0 && !frontier.empty(); --k) {
+            pop_heap(frontier.begin(), frontier.end(), worse);
+            const uint32_t slot = frontier.back();
+            frontier.pop_back();
+            visit(cellOf(heap[slot]));
+            for (uint32_t child = 2 * slot + 1; child <= 2 * slot + 2 && child < count; ++child) {
+                frontier.push_back(child);
+                push_heap(frontier.begin(), frontier.end(), worse);
+            }
+        }
+    }
+
+private:
+    void place(uint32_t slot, uint64_t e) {
+        heap[slot] = e;
+        position[cellOf(e)] = slot + 1;
+    }
+
+    void remove(uint32_t slot) {
+        position[cellOf(heap[slot])] = 0;
+        const uint64_t last = heap[--count];
+        if (slot < count) {
+            siftUp(slot, last);
+            siftDown(position[cellOf(last)] - 1, last);
+        }
+    }
+
+    void siftUp(uint32_t slot, uint64_t e) {
+        while (slot > 0 && e < heap[(slot - 1) / 2]) {
+            place(slot, heap[(slot - 1) / 2]);
+            slot = (slot - 1) / 2;
+        }
+        place(slot, e);
+    }
+
+    void siftDown(uint32_t slot, uint64_t e) {
+        for (;;) {
+            uint32_t child = 2 * slot + 1;
+            if (child >= count) break;
+            if (child + 1 < count && heap[child + 1] < heap[child]) ++child;
+            if (heap[child] >= e) break;
+            place(slot, heap[child]);
+            slot = child;
+        }
+        place(slot, e);
+    }
+};
+
 // Stage3: stable subflow merger
+template <class Config = DefaultConfig>
 class Stage3Merger {
 private:
-    vector<vector<Stage3Cell>> buckets;
+    // Config parameters; inside the class they take the place of the parm.h defaults
+    static constexpr int MIN_SUBFLOWS = Config::MIN_SUBFLOWS;
+    static constexpr float STABLE_THRESHOLD = Config::STABLE_THRESHOLD;
+    static constexpr int P = Config::P;
+    static constexpr int Q = Config::Q;
+    static constexpr int STAGE3_BUCKETS = Config::STAGE3_BUCKETS;
+
+    static_assert(sizeof(Stage3Cell) == 32, "the seqlock sequence must not grow Stage3 cells");
+    static_assert(sizeof(Stage3Cell) % sizeof(uint64_t) == 0 && alignof(Stage3Cell) >= alignof(uint64_t),
+                  "Stage3 cells are copied as whole 64-bit words");
+
+    TableArena ownTables;  // Used when no arena is passed in
+    array<ArenaSpan<Stage3Cell>, STAGE3_BUCKETS> buckets;
     uint32_t hashSeed;
     mt19937 gen;
     uniform_real_distribution<float> dist;
     size_t l = 0;
     size_t b = 0;
+    size_t subflows = 0;
+    // Reports wait here until drained: reserved up front so that reporting never allocates, and bounded
+    // so that a sketch that runs for a long time without draining does not grow
+    vector<StableFlowReport> reported;
+    size_t droppedReports = 0;
+    // Top-k rankings over all cells (cell index = bucket * b + slot), when enabled
+    bool ranked = false;
+    CellHeap longest;    // Occupied cells, most merged subflows first
+    CellHeap steadiest;  // Cells with at least two merged subflows, lowest variance first
+
+    // Cells move between threads as whole 64-bit words with relaxed atomics, so that a reader copying a
+    // cell never races with the ingest thread storing it; the sequence brackets order them
+    typedef uint64_t __attribute__((may_alias)) CellWord;
+    static constexpr size_t CELL_WORDS = sizeof(Stage3Cell) / sizeof(CellWord);
+
+    static void storeCellWords(Stage3Cell& to, const Stage3Cell& from) {
+        CellWord* words = reinterpret_cast<CellWord*>(&to);
+        const CellWord* source = reinterpret_cast<const CellWord*>(&from);
+        for (size_t i = 0; i < CELL_WORDS; ++i) {
+            __atomic_store_n(&words[i], source[i], __ATOMIC_RELAXED);
+        }
+    }
+
+    static void loadCellWords(Stage3Cell& to, const Stage3Cell& from) {
+        CellWord* words = reinterpret_cast<CellWord*>(&to);
+        const CellWord* source = reinterpret_cast<const CellWord*>(&from);
+        for (size_t i = 0; i < CELL_WORDS; ++i) {
+            words[i] = __atomic_load_n(&source[i], __ATOMIC_RELAXED);
+        }
+    }
+
+    // Seqlock write side, on the ingest thread only: the cell's sequence is odd for the guard's
+    // lifetime. The guard's cell is a copy that the caller rewrites; leaving the guard stores it back
+    // word by word, moves it to its new place in the rankings, and makes the sequence even again.
+    struct CellWrite {
+        Stage3Merger& merger;
+        uint32_t index;
+        Stage3Cell& target;
+        Stage3Cell cell;
+        CellWrite(Stage3Merger& m, size_t bucket, size_t slot)
+            : merger(m), index(static_cast<uint32_t>(bucket * m.b + slot)), target(m.buckets[bucket][slot]) {
+            __atomic_store_n(&target.sequence, static_cast<uint16_t>(target.sequence + 1), __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            // Only this thread stores cells, so a plain read of its own cell is safe
+            cell = target;
+        }
+        ~CellWrite() {
+            storeCellWords(target, cell);
+            merger.rankCell(index);
+            __atomic_store_n(&target.sequence, static_cast<uint16_t>(cell.sequence + 1), __ATOMIC_RELEASE);
+        }
+    };
+
+    const Stage3Cell& cellOf(uint32_t index) const { return buckets[index / b][index % b]; }
+
+    static bool rankedLongest(const Stage3Cell& cell) { return !cell.empty(); }
+    // A single subflow's variance says little about the flow: rank from the first merge on
+    static bool rankedSteadiest(const Stage3Cell& cell) { return !cell.empty() && cell.number >= 2; }
+
+    // Ranks, lower first: most merged subflows, and lowest variance (float bits in numeric order)
+    static uint32_t longestRank(const Stage3Cell& cell) { return UINT16_MAX - cell.number; }
+    static uint32_t steadiestRank(const Stage3Cell& cell) {
+        uint32_t bits;
+        memcpy(&bits, &cell.s.variance, sizeof(bits));
+        return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+    }
+
+    void rankCell(uint32_t index) {
+        if (!ranked) return;
+        const Stage3Cell& cell = cellOf(index);
+        longest.update(index, rankedLongest(cell), longestRank(cell));
+        steadiest.update(index, rankedSteadiest(cell), steadiestRank(cell));
+    }
+
+    // The first k cells of a ranking; without the rankings, a scan of every cell
+    template <class Member, class Rank>
+    vector<StableFlowReport> topCells(const CellHeap& ranking, size_t k, Member member, Rank rank) const {
+        vector<uint32_t> cells;
+        if (ranked) {
+            ranking.top(k, [&](uint32_t index) { cells.push_back(index); });
+        } else {
+            vector<uint64_t> entries;
+            for (uint32_t index = 0; index < l * b; ++index) {
+                if (member(cellOf(index))) entries.push_back(CellHeap::entry(index, rank(cellOf(index))));
+            }
+            const size_t n = min(k, entries.size());
+            partial_sort(entries.begin(), entries.begin() + n, entries.end());
+            for (size_t i = 0; i < n; ++i) {
+                cells.push_back(CellHeap::cellOf(entries[i]));
+            }
+        }
+        vector<StableFlowReport> top;
+        top.reserve(cells.size());
+        for (uint32_t index : cells) {
+            top.push_back(reportOf(cellOf(index)));
+        }
+        return top;
+    }
+
+    static StableFlowReport reportOf(const Stage3Cell& cell) {
+        StableFlowReport report;
+        memcpy(report.ID, cell.ID, KEY_LEN);
+        report.startWindow = cell.window;
+        report.endWindow = cell.window + cell.number * MIN_SUBFLOWS - 1;
+        report.subflows = cell.number;
+        report.mean = cell.s.mean;
+        report.variance = cell.s.variance;
+        return report;
+    }
+
+    // Seqlock read side: a copy of the cell taken between two equal, even sequence values
+    static Stage3Cell readCell(const Stage3Cell& cell) {
+        Stage3Cell copy;
+        for (;;) {
+            const uint16_t before = __atomic_load_n(&cell.sequence, __ATOMIC_ACQUIRE);
+            if (!(before & 1)) {
+                loadCellWords(copy, cell);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&cell.sequence, __ATOMIC_RELAXED) == before) {
+                    return copy;
+                }
+            }
+            this_thread::yield();
+        }
+    }
 
     // Check if new subflow can be merged: incremental variance calculation
     static bool canMergeVariance(const Stage3Cell& cell, float newVar, float newMean) {
@@ -62,7 +313,6 @@ private:
     void clearCell(Stage3Cell& cell) {
         if (!cell.empty() && cell.number >= 1) {
             if (cell.number >= Q) {
-                string flowIDStr(cell.ID, strnlen(cell.ID, KEY_LEN));
                 float V_star = cell.s.variance;
 
                 if (V_star > STABLE_THRESHOLD) {
@@ -70,7 +320,13 @@ private:
                     return;
                 }
 
-                uint32_t endWindow = cell.window + cell.number * MIN_SUBFLOWS - 1;
+                if (reported.size() < STAGE3_REPORT_CAPACITY) {
+                    reported.push_back(reportOf(cell));
+                } else {
+                    ++droppedReports;
+                }
+                PLACID_STAT(stage3, cellsReported);
+                PLACID_PROBE3(stage3_report, cell.ID, static_cast<uint32_t>(cell.window), static_cast<uint32_t>(cell.number));
             }
         }
         cell.clear();
@@ -99,22 +355,37 @@ private:
             const float V_star = term1 + term2;
 
             cell.number++;
+            PLACID_STAT(stage3, merges);
             cell.s.mean = mu_star;
             cell.s.variance = V_star;
         }
     }
 
 public:
-    explicit Stage3Merger(): hashSeed(0x300),gen(random_device{}()),dist(0.0f, 1.0f)
+    // useRankings keeps the top-k rankings, 24 bytes per cell charged to memoryBytes (fewer cells for
+    // the same budget); tables come from arena, or from one of its own when it is nullptr
+    explicit Stage3Merger(uint32_t rngSeed = STAGE3_RNG_SEED, size_t memoryBytes = STAGE3_MEMORY_BYTES,
+                          bool useRankings = STAGE3_TOP_K, TableArena* arena = nullptr)
+        : hashSeed(0x300),gen(rngSeed),dist(0.0f, 1.0f),ranked(useRankings)
     {
         l = STAGE3_BUCKETS;
-        size_t cellSize = sizeof(Stage3Cell);
-        size_t perBucketBytes = (l > 0) ? (STAGE3_MEMORY_BYTES / l) : 0;
+        size_t cellSize = sizeof(Stage3Cell) + (ranked ? 2 * (sizeof(uint64_t) + sizeof(uint32_t)) : 0);
+        size_t perBucketBytes = (l > 0) ? (memoryBytes / l) : 0;
         b = (cellSize > 0) ? max<size_t>(1, perBucketBytes / cellSize) : 1;
 
-        buckets.resize(l);
-        for (size_t i = 0; i < l; ++i) {
-            buckets[i].resize(b);
+        // All-zero cells are empty
+        reported.reserve(STAGE3_REPORT_CAPACITY);
+
+        TableArena& tables = arena ? *arena : ownTables;
+        tables.reserve(memoryBytes);
+        for (auto& bucket : buckets) {
+            bucket = tables.allocate<Stage3Cell>(b);
+        }
+        if (ranked) {
+            for (CellHeap* ranking : {&longest, &steadiest}) {
+                ranking->heap = tables.allocate<uint64_t>(l * b);
+                ranking->position = tables.allocate<uint32_t>(l * b);
+            }
         }
     }
 
@@ -122,16 +393,77 @@ public:
         finalize();
     }
 
+    size_t bucketCount() const { return l; }
+    size_t cellsPerBucket() const { return b; }
+    const Stage3Cell& cellAt(size_t bucket, size_t index) const { return buckets[bucket][index]; }
+
+    // Stable subflows received from Stage2
+    size_t subflowsProcessed() const { return subflows; }
+
+    // Stable flows reported since the last drain, in report order; after finalize(), every report not
+    // drained yet
+    const vector<StableFlowReport>& reports() const { return reported; }
+
+    // Hands the buffered reports to consume(report) in report order and empties the buffer. A sketch
+    // that runs indefinitely drains regularly: at most STAGE3_REPORT_CAPACITY reports are held, and
+    // reports beyond that are dropped and counted in reportsDropped().
+    template <class Consume>
+    void drainReports(Consume&& consume) {
+        for (const StableFlowReport& report : reported) {
+            consume(report);
+        }
+        reported.clear();
+    }
+    size_t reportsDropped() const { return droppedReports; }
+
+    // Point query, safe on any thread while another one ingests: each cell of the flow's bucket is
+    // read under its seqlock, and the ingest path takes no locks. A flow whose cell is replaced and
+    // re-created at an earlier slot during the scan can be missed by that one query.
+    FlowStability queryFlow(const char* flowID) const {
+        uint32_t h = 0;
+        MurmurHash3_x86_32(flowID, KEY_LEN, hashSeed, &h);
+        const auto& bucket = buckets[h % l];
+        FlowStability answer;
+        for (size_t a = 0; a < b; ++a) {
+            const Stage3Cell cell = readCell(bucket[a]);
+            if (cell.empty() || memcmp(cell.ID, flowID, KEY_LEN) != 0) {
+                continue;
+            }
+            answer.tracked = true;
+            answer.stable = cell.number >= Q && cell.s.variance <= STABLE_THRESHOLD;
+            answer.startWindow = cell.window;
+            answer.endWindow = cell.window + cell.number * MIN_SUBFLOWS - 1;
+            answer.subflows = cell.number;
+            answer.mean = cell.s.mean;
+            answer.variance = cell.s.variance;
+            break;
+        }
+        return answer;
+    }
+
+    // Top-k queries, on the ingest thread (between packets or windows). With the rankings they cost
+    // O(k log k) whatever the table size; without them they scan every cell.
+    // The k tracked flows with the most stable windows (subflows * MIN_SUBFLOWS), longest first
+    vector<StableFlowReport> topLongest(size_t k) const {
+        return topCells(longest, k, rankedLongest, longestRank);
+    }
+    // The k tracked flows with the lowest variance among those with at least two merged subflows
+    vector<StableFlowReport> topSteadiest(size_t k) const {
+        return topCells(steadiest, k, rankedSteadiest, steadiestRank);
+    }
+
     // Process stable subflow: merge or insert based on bucket state
     void processSteadySubflow(const char* flowID, uint32_t startW, float var, float mean) {
+        ++subflows;
         uint32_t h = 0;
         MurmurHash3_x86_32(flowID, KEY_LEN, hashSeed, &h);
         size_t u = h % l;
         auto& bucket = buckets[u];
 
         Stage3Cell* targetCell = nullptr;
+        int targetIndex = -1;
         int emptyIndex = -1;
-        vector<int> discontinuousIndices;
+        int discontinuousVictim = -1; // Discontinuous cell with the smallest number (first one on ties)
 
         // Scan bucket to find matching cell, empty slot, and discontinuous cells
         for (int a = 0; a < static_cast<int>(b); ++a) {
@@ -141,54 +473,60 @@ public:
             }
             if (memcmp(bucket[a].ID, flowID, KEY_LEN) == 0) {
                 targetCell = &bucket[a];
+                targetIndex = a;
             } else {
                 uint32_t lastwin = bucket[a].window + bucket[a].number * MIN_SUBFLOWS;
-                if (startW != lastwin) {
-                    discontinuousIndices.push_back(a);
+                if (startW != lastwin &&
+                    (discontinuousVictim < 0 || bucket[a].number < bucket[discontinuousVictim].number)) {
+                    discontinuousVictim = a;
                 }
             }
         }
 
         // Case 1: Empty slot available
         if (!targetCell && emptyIndex != -1) {
-            initNewCell(bucket[emptyIndex], flowID, startW, var, mean);
+            CellWrite write(*this, u, emptyIndex);
+            initNewCell(write.cell, flowID, startW, var, mean);
         }
         // Case 2: Matching cell found
         else if (targetCell) {
-            uint32_t lastwin = targetCell->window + targetCell->number * MIN_SUBFLOWS;
+            CellWrite write(*this, u, targetIndex);
+            uint32_t lastwin = write.cell.window + write.cell.number * MIN_SUBFLOWS;
 
             if (startW != lastwin) {
                 // Window discontinuity: report and reset
-                clearCell(*targetCell);
-                initNewCell(*targetCell, flowID, startW, var, mean);
+                PLACID_STAT(stage3, discontinuityResets);
+                PLACID_PROBE2(stage3_reset, flowID, 0);
+                clearCell(write.cell);
+                initNewCell(write.cell, flowID, startW, var, mean);
             } else {
                 // Continuous windows: try to merge
-                if (canMergeVariance(*targetCell, var, mean)) {
-                    mergeCell(*targetCell, var, mean);
-                    if (targetCell->number >= static_cast<uint32_t>(P)) {
+                if (canMergeVariance(write.cell, var, mean)) {
+                    mergeCell(write.cell, var, mean);
+                    PLACID_PROBE2(stage3_merge, flowID, static_cast<uint32_t>(write.cell.number));
+                    if (write.cell.number >= static_cast<uint32_t>(P)) {
                         // Max segments reached: report and reset
-                        clearCell(*targetCell);
-                        initNewCell(*targetCell, flowID, startW, var, mean);
+                        PLACID_PROBE2(stage3_reset, flowID, 2);
+                        clearCell(write.cell);
+                        initNewCell(write.cell, flowID, startW, var, mean);
                     }
                 } else {
                     // Merge failed: report and reset
-                    clearCell(*targetCell);
-                    initNewCell(*targetCell, flowID, startW, var, mean);
+                    PLACID_PROBE2(stage3_reset, flowID, 1);
+                    clearCell(write.cell);
+                    initNewCell(write.cell, flowID, startW, var, mean);
                 }
             }
         }
         // Case 3: No match, no empty slot
         else if (!targetCell) {
-            if (!discontinuousIndices.empty()) {
+            if (discontinuousVictim >= 0) {
                 // Replace discontinuous cell (prefer smallest number)
-                int victimIndex = discontinuousIndices[0];
-                for (int idx : discontinuousIndices) {
-                    if (bucket[idx].number < bucket[victimIndex].number) {
-                        victimIndex = idx;
-                    }
-                }
-                clearCell(bucket[victimIndex]);
-                initNewCell(bucket[victimIndex], flowID, startW, var, mean);
+                CellWrite write(*this, u, discontinuousVictim);
+                PLACID_STAT(stage3, discontinuityResets);
+                PLACID_PROBE3(stage3_replace, flowID, write.cell.ID, 1);
+                clearCell(write.cell);
+                initNewCell(write.cell, flowID, startW, var, mean);
             } else {
                 // All cells continuous: probabilistic replacement
                 int victimIndex = -1;
@@ -207,8 +545,14 @@ public:
                     uint32_t totalStableWindows = minStableWindows * MIN_SUBFLOWS;
                     float replaceProb = 1.0f / max(1.0f, static_cast<float>(totalStableWindows - MIN_SUBFLOWS + 1));
                     if (dist(gen) <= replaceProb) {
-                        clearCell(bucket[victimIndex]);
-                        initNewCell(bucket[victimIndex], flowID, startW, var, mean);
+                        CellWrite write(*this, u, victimIndex);
+                        PLACID_STAT(stage3, replacementsTaken);
+                        PLACID_PROBE3(stage3_replace, flowID, write.cell.ID, 1);
+                        clearCell(write.cell);
+                        initNewCell(write.cell, flowID, startW, var, mean);
+                    } else {
+                        PLACID_STAT(stage3, replacementsSkipped);
+                        PLACID_PROBE3(stage3_replace, flowID, bucket[victimIndex].ID, 0);
                     }
                 }
             }
@@ -216,9 +560,10 @@ public:
     }
 
     void finalize() {
-        for (auto& bucket : buckets) {
-            for (auto& cell : bucket) {
-                clearCell(cell);
+        for (size_t u = 0; u < l; ++u) {
+            for (size_t a = 0; a < b; ++a) {
+                CellWrite write(*this, u, a);
+                clearCell(write.cell);
             }
         }
     }
@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+using namespace std;
+#include <cstdint>
+#include <cstdio>
+
+// Hot-path counters, compiled out unless built with -DPLACID_STATS=1.
+// Each thread counts into its own PlacidStats; every stage gets its own cache line so a
+// stage's counters never share a line with another stage's.
+#ifndef PLACID_STATS
+#define PLACID_STATS 0
+#endif
+
+struct alignas(64) Stage1Stats {
+    uint64_t promotions = 0;    // Flows promoted to Stage2
+    uint64_t emptyInits = 0;    // Empty buckets initialized by a new flow
+    uint64_t resets = 0;        // Buckets cleared by resetBuckets
+};
+
+struct alignas(64) Stage2Stats {
+    uint64_t rebirths = 0;            // Counter wraps handled by updateCKOnRebirth
+    uint64_t ckUpdateFailures = 0;    // Wraps that reset the bucket instead
+    uint64_t stabilityRejections = 0; // Window transitions that failed checkStability
+    uint64_t subflowsEmitted = 0;     // Stable subflows handed to Stage3
+};
+
+struct alignas(64) Stage3Stats {
+    uint64_t merges = 0;               // Subflows merged into their flow's cell
+    uint64_t discontinuityResets = 0;  // Own or victim cells restarted because their windows are not continuous
+    uint64_t replacementsTaken = 0;    // Probabilistic replacements that evicted a cell
+    uint64_t replacementsSkipped = 0;  // Probabilistic replacements that dropped the subflow
+    uint64_t cellsReported = 0;        // Cells with at least Q subflows and a stable merged variance
+};
+
+struct PlacidStats {
+    Stage1Stats stage1;
+    Stage2Stats stage2;
+    Stage3Stats stage3;
+};
+
+inline PlacidStats& placidStats() {
+    static thread_local PlacidStats stats;
+    return stats;
+}
+
+// One line per window for the calling thread, then start counting the next window from zero
+inline void dumpPlacidStats(uint32_t window, FILE* out = stderr) {
+    PlacidStats& s = placidStats();
+    fprintf(out,
+            "stats window=%u stage1.promotions=%llu stage1.emptyInits=%llu stage1.resets=%llu "
+            "stage2.rebirths=%llu stage2.ckUpdateFailures=%llu stage2.stabilityRejections=%llu "
+            "stage2.subflowsEmitted=%llu stage3.merges=%llu stage3.discontinuityResets=%llu "
+            "stage3.replacementsTaken=%llu stage3.replacementsSkipped=%llu stage3.cellsReported=%llu\n",
+            window, (unsigned long long)s.stage1.promotions, (unsigned long long)s.stage1.emptyInits,
+            (unsigned long long)s.stage1.resets, (unsigned long long)s.stage2.rebirths,
+            (unsigned long long)s.stage2.ckUpdateFailures, (unsigned long long)s.stage2.stabilityRejections,
+            (unsigned long long)s.stage2.subflowsEmitted, (unsigned long long)s.stage3.merges,
+            (unsigned long long)s.stage3.discontinuityResets, (unsigned long long)s.stage3.replacementsTaken,
+            (unsigned long long)s.stage3.replacementsSkipped, (unsigned long long)s.stage3.cellsReported);
+    s = PlacidStats();
+}
+
+// A tool that reads placidStats() itself defines PLACID_STATS_DUMP before including this header,
+// so the counters accumulate over the whole run instead
+#if PLACID_STATS
+#define PLACID_STAT(stage, counter) (++placidStats().stage.counter)
+#ifndef PLACID_STATS_DUMP
+#define PLACID_STATS_DUMP(window) dumpPlacidStats(window)
+#endif
+#else
+#define PLACID_STAT(stage, counter) ((void)0)
+#ifndef PLACID_STATS_DUMP
+#define PLACID_STATS_DUMP(window) ((void)0)
+#endif
+#endif
+
+#endif
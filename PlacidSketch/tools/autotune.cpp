@@ -0,0 +1,323 @@
+// Memory-budget autotuner: for a total byte budget and a short trace sample, searches the Stage1
+// share of the Stage1+2 budget, the Stage3 share of the total and the table geometry (every
+// precompiled configuration that detects like --preset and differs only in STAGE1_ROWS, STAGE2_ROWS
+// and STAGE3_BUCKETS) for the best F1 against the exact ground truth of the sample. The result is a
+// config file for main --config.
+//
+// Each geometry gets a coordinate search over the two shares, guided and pruned by the hot-path
+// counters (stats.h, accumulated over the whole run here):
+//   - Stage3 replacement rate (replacements per emitted subflow): with no replacement pressure a
+//     larger Stage3 cannot help, so only smaller Stage3 shares are tried; with pressure, a smaller
+//     Stage3 is tried only if the larger one lost.
+//   - Stage1 promotions and Stage2 reset churn (stability rejections and failed rebirths per emitted
+//     subflow): a larger Stage1 share is followed only while it cuts promotions, and a smaller one
+//     (wider Stage2) only while it cuts churn.
+//   autotune (--trace DIR | --synthetic) [--budget-kb N] [--sample-windows N] [--preset NAME]
+//            [--threads N] [--out FILE] [--seed N] [--windows N] [--background-flows N]
+//            [--background-packets N] [--zipf X] [--planted N] [--mean-min X] [--mean-max X]
+//            [--duration-min N] [--duration-max N]
+#define PLACID_STATS 1
+#define PLACID_STATS_DUMP(window) ((void)0)
+#include "parm.h"
+#include "PlacidSketch.h"
+#include "ConfigDispatch.h"
+#include "ground_truth_baseline.h"
+#include "TraceGenerator.h"
+#include "TraceFiles.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static void usage() {
+    fprintf(stderr, "usage: autotune (--trace DIR | --synthetic) [--budget-kb N] [--sample-windows N] "
+                    "[--preset NAME] [--threads N] [--out FILE] [--seed N] [--windows N] [--background-flows N] "
+                    "[--background-packets N] [--zipf X] [--planted N] [--mean-min X] [--mean-max X] "
+                    "[--duration-min N] [--duration-max N]\n");
+}
+
+// Search grids; the search starts from the entries nearest the parm.h split
+static const double STAGE1_RATIOS[] = {0.03, 0.05, 0.083, 0.12, 0.18, 0.25};
+static const double STAGE3_SHARES[] = {0.1, 0.15, 0.2, 0.25, 0.33, 0.45};
+static constexpr int RATIO_STEPS = sizeof(STAGE1_RATIOS) / sizeof(STAGE1_RATIOS[0]);
+static constexpr int SHARE_STEPS = sizeof(STAGE3_SHARES) / sizeof(STAGE3_SHARES[0]);
+
+// Pruning thresholds
+static constexpr double NO_PRESSURE = 0.01;  // Stage3 replacement rate below which Stage3 has spare cells
+static constexpr double MIN_GAIN = 0.05;     // Relative cut a step must make in the counter it targets
+
+struct Evaluation {
+    SketchParameters params;
+    int ratio = 0;   // Index into STAGE1_RATIOS
+    int share = 0;   // Index into STAGE3_SHARES
+    double f1 = 0.0;
+    size_t reports = 0;
+    PlacidStats stats;
+
+    double replacementRate() const {
+        return double(stats.stage3.replacementsTaken + stats.stage3.replacementsSkipped) /
+               max<uint64_t>(1, stats.stage2.subflowsEmitted);
+    }
+
+    double churn() const {
+        return double(stats.stage2.stabilityRejections + stats.stage2.ckUpdateFailures) /
+               max<uint64_t>(1, stats.stage2.subflowsEmitted);
+    }
+
+    // Higher F1 first; on a tie (e.g. a sample too short for any stable period) more Stage3 merges
+    bool betterThan(const Evaluation& o) const {
+        if (fabs(f1 - o.f1) > 1e-9) return f1 > o.f1;
+        return stats.stage3.merges > o.stats.stage3.merges;
+    }
+};
+
+struct Tuner {
+    const SharedTrace& trace;
+    const vector<StablePeriod>& periods;
+    size_t budgetBytes;
+    mutex printLock;
+    atomic<size_t> evaluations{0};
+
+    Tuner(const SharedTrace& t, const vector<StablePeriod>& truth, size_t budget)
+        : trace(t), periods(truth), budgetBytes(budget) {}
+
+    Evaluation evaluate(const SketchParameters& geometry, int ratio, int share) {
+        Evaluation e;
+        e.params = geometry;
+        e.ratio = ratio;
+        e.share = share;
+        e.params.stage3Bytes = static_cast<size_t>(budgetBytes * STAGE3_SHARES[share]);
+        const size_t stage12 = budgetBytes - e.params.stage3Bytes;
+        e.params.stage1Bytes = static_cast<size_t>(stage12 * STAGE1_RATIOS[ratio]);
+        e.params.stage2Bytes = stage12 - e.params.stage1Bytes;
+
+        placidStats() = PlacidStats();
+        dispatchConfig(e.params, [&](auto config) {
+            using Config = decltype(config);
+            unique_ptr<PlacidSketch<Config>> sketch(
+                new PlacidSketch<Config>(e.params.stage1Bytes, e.params.stage2Bytes, e.params.stage3Bytes));
+            vector<StableFlowReport> reports;
+            auto collect = [&](const StableFlowReport& report) { reports.push_back(report); };
+            trace.replay([&](const char* flowID, uint32_t window) {
+                sketch->processPacket(flowID, window);
+                sketch->drainStableFlows(collect);
+            });
+            sketch->finalizeProcessing();
+            sketch->drainStableFlows(collect);
+            DetectionAccuracy acc = compareWithGroundTruth(periods, reports);
+            e.f1 = acc.f1;
+            e.reports = acc.reports;
+        });
+        e.stats = placidStats();
+        ++evaluations;
+
+        lock_guard<mutex> guard(printLock);
+        printf("%-12s %8zu %8zu %8zu %8.4f %8zu %10.4f %8.3f %12llu\n", configName(e.params).c_str(),
+               e.params.stage1Bytes / 1024, e.params.stage2Bytes / 1024, e.params.stage3Bytes / 1024, e.f1,
+               e.reports, e.replacementRate(), e.churn(), (unsigned long long)e.stats.stage1.promotions);
+        fflush(stdout);
+        return e;
+    }
+
+    // Coordinate search over the two shares for one geometry
+    Evaluation search(const SketchParameters& geometry, int ratio, int share) {
+        map<pair<int, int>, Evaluation> seen;
+        auto at = [&](int r, int s) -> const Evaluation& {
+            auto it = seen.find({r, s});
+            if (it == seen.end()) it = seen.emplace(make_pair(r, s), evaluate(geometry, r, s)).first;
+            return it->second;
+        };
+        Evaluation best = at(ratio, share);
+        for (bool moved = true; moved;) {
+            moved = false;
+
+            // Stage3 share
+            const bool pressure = best.replacementRate() >= NO_PRESSURE;
+            bool improved = false;
+            if (pressure) {
+                for (int s = best.share + 1; s < SHARE_STEPS; ++s) {
+                    const Evaluation& e = at(best.ratio, s);
+                    if (!e.betterThan(best)) break;
+                    best = e;
+                    improved = moved = true;
+                }
+            }
+            for (int s = best.share - 1; !improved && s >= 0; --s) {
+                const Evaluation& e = at(best.ratio, s);
+                if (!e.betterThan(best)) break;
+                best = e;
+                moved = true;
+                if (!pressure && e.replacementRate() >= NO_PRESSURE) break;  // Shrinking created pressure
+            }
+
+            // Stage1 share of the Stage1+2 budget
+            improved = false;
+            for (int r = best.ratio + 1; r < RATIO_STEPS; ++r) {
+                const Evaluation& e = at(r, best.share);
+                const bool cutsPromotions = e.stats.stage1.promotions < (1.0 - MIN_GAIN) * best.stats.stage1.promotions;
+                if (!e.betterThan(best)) break;
+                best = e;
+                improved = moved = true;
+                if (!cutsPromotions) break;
+            }
+            for (int r = best.ratio - 1; !improved && r >= 0; --r) {
+                const Evaluation& e = at(r, best.share);
+                const bool cutsChurn = e.churn() < (1.0 - MIN_GAIN) * best.churn();
+                if (!e.betterThan(best)) break;
+                best = e;
+                moved = true;
+                if (!cutsChurn) break;
+            }
+        }
+        return best;
+    }
+
+    static string configName(const SketchParameters& params) {
+        string name = "?";
+        dispatchConfig(params, [&](auto config) { name = decltype(config)::NAME; });
+        return name;
+    }
+};
+
+template <class... Configs>
+static void geometriesLike(const SketchParameters& base, vector<SketchParameters>& out, ConfigList<Configs...>) {
+    ((SketchParameters::of<Configs>().sameDetection(base) ? out.push_back(SketchParameters::of<Configs>()) : void()),
+     ...);
+}
+
+template <size_t N>
+static int nearest(const double (&grid)[N], double value) {
+    int best = 0;
+    for (size_t i = 1; i < N; ++i) {
+        if (fabs(grid[i] - value) < fabs(grid[best] - value)) best = static_cast<int>(i);
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    string traceDir, outPath, preset = DefaultConfig::NAME;
+    bool synthetic = false;
+    size_t budgetKb = (STAGE1_2_TOTAL_MEMORY_BYTES + STAGE3_MEMORY_BYTES) / 1024;
+    uint32_t sampleWindows = 0;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    TraceConfig traceConfig = evaluationDefaults();
+
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--synthetic") {
+            synthetic = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--trace") traceDir = value;
+        else if (arg == "--out") outPath = value;
+        else if (arg == "--preset") preset = value;
+        else if (arg == "--budget-kb") budgetKb = strtoull(value, nullptr, 0);
+        else if (arg == "--sample-windows") sampleWindows = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+        else if (arg == "--threads") threads = static_cast<unsigned>(strtoul(value, nullptr, 0));
+        else if (setTraceOption(traceConfig, arg, value)) continue;
+        else {
+            usage();
+            return 2;
+        }
+    }
+    SketchParameters base;
+    if (synthetic == !traceDir.empty() || threads == 0 || budgetKb < 16 || !validTraceConfig(traceConfig) ||
+        !presetParameters(preset, base)) {
+        usage();
+        return 2;
+    }
+    vector<SketchParameters> geometries;
+    geometriesLike(base, geometries, PrecompiledConfigs());
+
+    SharedTrace trace;
+    GroundTruthConfig truthConfig;
+    truthConfig.threads = threads;
+    GroundTruthBaseline truth(truthConfig);
+    bool ok = true;
+    auto load = [&](uint32_t window, const vector<Packet>& packets) {
+        ok = ok && trace.addWindow(window, packets) && truth.addWindow(window, packets);
+    };
+    if (synthetic) {
+        TraceGenerator(traceConfig).forEachWindow(threads, load);
+    } else {
+        vector<string> files;
+        if (!listWindowFiles(traceDir, files)) {
+            fprintf(stderr, "autotune: no window CSV files in %s\n", traceDir.c_str());
+            return 1;
+        }
+        if (sampleWindows > 0 && sampleWindows < files.size()) {
+            files.resize(sampleWindows);
+        }
+        string failed;
+        if (!forEachWindowFile(files, load, failed)) {
+            fprintf(stderr, "autotune: failed to read %s\n", failed.c_str());
+            return 1;
+        }
+    }
+    vector<StablePeriod> periods;
+    if (!ok || !truth.finish(periods)) {
+        fprintf(stderr, "autotune: loading the trace failed\n");
+        return 1;
+    }
+    trace.seal();
+    printf("sample: %zu packets, %u windows, %zu flows, %zu stable periods; budget %zu KB\n",
+           trace.packets.size(), trace.windows(), trace.flows(), periods.size(), budgetKb);
+    if (periods.empty()) {
+        printf("no stable period in the sample: ranking by Stage3 merges only; use a longer sample\n");
+    }
+    printf("%-12s %8s %8s %8s %8s %8s %10s %8s %12s\n", "config", "S1 KB", "S2 KB", "S3 KB", "F1", "reports",
+           "S3 repl", "S2 churn", "promotions");
+
+    // One search per geometry, on a pool of threads (the counters are per thread)
+    Tuner tuner(trace, periods, budgetKb * 1024);
+    const int ratio = nearest(STAGE1_RATIOS, STAGE1_MEMORY_RATIO);
+    const int share = nearest(STAGE3_SHARES, double(STAGE3_MEMORY_BYTES) / (STAGE1_2_TOTAL_MEMORY_BYTES + STAGE3_MEMORY_BYTES));
+    vector<Evaluation> results(geometries.size());
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (unsigned t = 0; t < min<size_t>(threads, geometries.size()); ++t) {
+        workers.emplace_back([&] {
+            for (size_t g = next++; g < geometries.size(); g = next++) {
+                results[g] = tuner.search(geometries[g], ratio, share);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    const Evaluation* best = &results[0];
+    for (const auto& result : results) {
+        if (result.betterThan(*best)) best = &result;
+    }
+    printf("\nbest of %zu evaluations (full grid: %zu): %s, F1 %.4f\n", tuner.evaluations.load(),
+           geometries.size() * RATIO_STEPS * SHARE_STEPS, Tuner::configName(best->params).c_str(), best->f1);
+
+    FILE* out = outPath.empty() ? stdout : fopen(outPath.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "autotune: cannot write %s\n", outPath.c_str());
+        return 1;
+    }
+    fprintf(out, "# autotune: %s, budget %zu KB, %u sample windows, F1 %.4f\n", Tuner::configName(best->params).c_str(),
+            budgetKb, trace.windows(), best->f1);
+    best->params.write(out);
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "autotune: failed to write %s\n", outPath.c_str());
+        return 1;
+    }
+    return 0;
+}
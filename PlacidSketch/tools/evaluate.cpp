@@ -0,0 +1,250 @@
+// Head-to-head evaluation of PlacidSketch and SteadySketch at the same memory budget: throughput,
+// resident memory and accuracy (precision, recall, F1, ARE) of the reported stable flows against the
+// exact ground truth, on a CSV trace directory (one file per window, as main reads) or on a synthetic
+// trace generated in memory. The trace is loaded once, with the ground truth, into a shared table
+// (TraceFiles.h); each sketch then replays it in its own child process, which inherits the table and
+// allocates nothing else. A replay-only child gives the peak RSS of the loaded trace, and the rest of
+// a sketch child's peak RSS is the sketch.
+//   evaluate (--trace DIR | --synthetic) [--memory-kb N] [--threads N] [--partition-bits N]
+//            [--memory-mb N] [--spill DIR] [--seed N] [--windows N] [--background-flows N]
+//            [--background-packets N] [--zipf X] [--planted N] [--mean-min X] [--mean-max X]
+//            [--duration-min N] [--duration-max N]
+#include "parm.h"
+#include "PlacidSketch.h"
+#include "SteadySketch.h"
+#include "ground_truth_baseline.h"
+#include "TraceGenerator.h"
+#include "TraceFiles.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+static void usage() {
+    fprintf(stderr, "usage: evaluate (--trace DIR | --synthetic) [--memory-kb N] [--threads N] [--partition-bits N] "
+                    "[--memory-mb N] [--spill DIR] [--seed N] [--windows N] [--background-flows N] "
+                    "[--background-packets N] [--zipf X] [--planted N] [--mean-min X] [--mean-max X] "
+                    "[--duration-min N] [--duration-max N]\n");
+}
+
+struct SketchRun {
+    string name;
+    bool ok = false;
+    size_t packets = 0;
+    double seconds = 0.0;  // processPacket and finalize only
+    long peakRssKb = 0;    // Loaded trace included
+    vector<StableFlowReport> reports;
+};
+
+static bool writeAll(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Replays the trace through Sketch in a child process; Sketch = void reads the trace only
+template <class Sketch, class Make>
+static SketchRun runIsolated(const string& name, const SharedTrace& trace, Make make) {
+    SketchRun run;
+    run.name = name;
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return run;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        size_t packets = 0;
+        double seconds = 0.0;
+        vector<StableFlowReport> reports;
+        bool ok = true;
+        if constexpr (is_void<Sketch>::value) {
+            // Read every key as a sketch would, so that both children touch the same trace pages
+            volatile char sink = 0;
+            trace.replay([&](const char* flowID, uint32_t) {
+                sink = flowID[0];
+                ++packets;
+            });
+        } else {
+            auto sketch = make();
+            auto collect = [&](const StableFlowReport& report) { reports.push_back(report); };
+            auto start = chrono::steady_clock::now();
+            for (uint32_t w = 0; w < trace.windows(); ++w) {
+                for (size_t i = trace.windowStart[w]; i < trace.windowStart[w + 1]; ++i) {
+                    sketch->processPacket(trace.key(trace.packets[i]), w);
+                }
+                sketch->drainStableFlows(collect);
+            }
+            sketch->finalizeProcessing();
+            seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            packets = trace.packets.size();
+            sketch->drainStableFlows(collect);
+        }
+        const size_t count = reports.size();
+        ok = ok && writeAll(fds[1], &packets, sizeof(packets)) && writeAll(fds[1], &seconds, sizeof(seconds)) &&
+             writeAll(fds[1], &count, sizeof(count)) &&
+             writeAll(fds[1], reports.data(), count * sizeof(StableFlowReport));
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return run;
+    }
+    size_t count = 0;
+    bool ok = readAll(fds[0], &run.packets, sizeof(run.packets)) && readAll(fds[0], &run.seconds, sizeof(run.seconds)) &&
+              readAll(fds[0], &count, sizeof(count));
+    if (ok) {
+        run.reports.resize(count);
+        ok = readAll(fds[0], run.reports.data(), count * sizeof(StableFlowReport));
+    }
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage {};
+    wait4(pid, &status, 0, &usage);
+    run.peakRssKb = usage.ru_maxrss;  // Kilobytes on Linux
+    run.ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    return run;
+}
+
+int main(int argc, char** argv) {
+    string traceDir;
+    bool synthetic = false;
+    size_t memoryKb = (STAGE1_2_TOTAL_MEMORY_BYTES + STAGE3_MEMORY_BYTES) / 1024;
+    GroundTruthConfig truthConfig;
+    truthConfig.threads = max(1u, thread::hardware_concurrency());
+    TraceConfig traceConfig = evaluationDefaults();
+
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--synthetic") {
+            synthetic = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--trace") traceDir = value;
+        else if (arg == "--memory-kb") memoryKb = strtoull(value, nullptr, 0);
+        else if (arg == "--threads") truthConfig.threads = static_cast<unsigned>(strtoul(value, nullptr, 0));
+        else if (arg == "--partition-bits") truthConfig.partitionBits = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+        else if (arg == "--memory-mb") truthConfig.memoryBytes = strtoull(value, nullptr, 0) << 20;
+        else if (arg == "--spill") truthConfig.spillDirectory = value;
+        else if (setTraceOption(traceConfig, arg, value)) continue;
+        else {
+            usage();
+            return 2;
+        }
+    }
+    const size_t memoryBytes = memoryKb * 1024;
+    if (synthetic == !traceDir.empty() || truthConfig.partitionBits > 16 || !validTraceConfig(traceConfig) ||
+        memoryBytes <= STAGE3_MEMORY_BYTES) {
+        usage();
+        return 2;
+    }
+    if (!truthConfig.spillDirectory.empty()) {
+        error_code ec;
+        filesystem::create_directories(truthConfig.spillDirectory, ec);
+    }
+
+    // Load once: the shared table and the ground truth are both built from the same pass
+    SharedTrace trace;
+    GroundTruthBaseline truth(truthConfig);
+    auto start = chrono::steady_clock::now();
+    bool ok = true;
+    auto load = [&](uint32_t window, const vector<Packet>& packets) {
+        ok = ok && trace.addWindow(window, packets) && truth.addWindow(window, packets);
+    };
+    if (synthetic) {
+        TraceGenerator(traceConfig).forEachWindow(truthConfig.threads, load);
+    } else {
+        vector<string> files;
+        if (!listWindowFiles(traceDir, files)) {
+            fprintf(stderr, "evaluate: no window CSV files in %s\n", traceDir.c_str());
+            return 1;
+        }
+        string failed;
+        if (!forEachWindowFile(files, load, failed)) {
+            fprintf(stderr, "evaluate: failed to read %s\n", failed.c_str());
+            return 1;
+        }
+    }
+    vector<StablePeriod> periods;
+    if (!ok || !truth.finish(periods)) {
+        fprintf(stderr, "evaluate: ground truth failed (spill directory %s)\n", truthConfig.spillDirectory.c_str());
+        return 1;
+    }
+    trace.seal();
+    const double loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    // The children inherit the loader's freed pages too; hand them back so that both start alike
+    malloc_trim(0);
+
+    // Equal budgets: PlacidSketch keeps its fixed Stage3 and splits the rest between Stage1 and Stage2.
+    // Built budget-only it has no tables beyond the three stages (Stage3 rankings, when enabled, come
+    // out of the Stage3 share) and no huge-page arena, as SteadySketch spends its budget on buckets only.
+    const size_t stage12 = memoryBytes - STAGE3_MEMORY_BYTES;
+    const size_t stage1 = static_cast<size_t>(stage12 * STAGE1_MEMORY_RATIO);
+    vector<SketchRun> runs;
+    runs.push_back(runIsolated<void>("replay only", trace, [] { return 0; }));
+    runs.push_back(runIsolated<PlacidSketch<>>("PlacidSketch", trace, [&] {
+        return unique_ptr<PlacidSketch<>>(new PlacidSketch<>(stage1, stage12 - stage1, STAGE3_MEMORY_BYTES,
+                                                             WINDOW_GRANULARITY_NS, REORDER_LATENESS_NS, true));
+    }));
+    runs.push_back(runIsolated<SteadySketch>("SteadySketch", trace, [&] {
+        return unique_ptr<SteadySketch>(new SteadySketch(memoryBytes));
+    }));
+    for (const auto& run : runs) {
+        if (!run.ok) {
+            fprintf(stderr, "evaluate: %s run failed\n", run.name.c_str());
+            return 1;
+        }
+    }
+
+    printf("%zu packets, %zu flows, %zu flow-windows, %.1f MB spilled\n", trace.packets.size(), truth.flowsSeen(),
+           truth.flowWindows(), truth.spilledBytes() / 1048576.0);
+    printf("loaded with ground truth in %.1f s on %u threads: %.1f MB trace table, %zu stable periods "
+           "(>= %d subflows of %d windows)\n\n", loadSeconds, truthConfig.threads, trace.bytes() / 1048576.0,
+           periods.size(), Q, SUBFLOW_WINDOWS);
+    // A sketch's resident memory is its child's peak RSS above the replay-only child's
+    printf("%-14s %9s %8s %10s %10s %8s %9s %7s %7s %10s %9s\n", "sketch", "memory", "Mpps", "peak RSS",
+           "sketch RSS", "reports", "precision", "recall", "F1", "ARE(len)", "ARE(mean)");
+    printf("%-14s %9s %8s %7.1f MB\n", runs[0].name.c_str(), "-", "-", runs[0].peakRssKb / 1024.0);
+    for (size_t i = 1; i < runs.size(); ++i) {
+        const SketchRun& run = runs[i];
+        DetectionAccuracy acc = compareWithGroundTruth(periods, run.reports);
+        printf("%-14s %6zu KB %8.2f %7.1f MB %7ld KB %8zu %9.4f %7.4f %7.4f %10.4f %9.4f\n", run.name.c_str(),
+               memoryKb, run.seconds > 0 ? run.packets / run.seconds / 1e6 : 0.0, run.peakRssKb / 1024.0,
+               run.peakRssKb - runs[0].peakRssKb, acc.reports, acc.precision, acc.recall, acc.f1, acc.lengthARE,
+               acc.meanARE);
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+// Memory-split sweep: loads a trace once (a CSV trace directory, one file per window as main reads,
+// or a synthetic trace generated in memory) into a shared read-only table of flow keys and per-window
+// packet indices, then runs one PlacidSketch per combination of Stage1+2 budget, Stage1 ratio and
+// Stage3 budget on a thread pool. Each configuration gets a row of throughput and accuracy against
+// the exact ground truth, computed once during loading.
+//   sweep (--trace DIR | --synthetic) [--total-kb LIST] [--stage1-ratio LIST] [--stage3-kb LIST]
+//         [--threads N] [--csv FILE] [--seed N] [--windows N] [--background-flows N]
+//         [--background-packets N] [--zipf X] [--planted N] [--mean-min X] [--mean-max X]
+//         [--duration-min N] [--duration-max N]
+// LIST is comma-separated, e.g. --total-kb 400,600,800 --stage1-ratio 0.05,0.083,0.15
+#include "parm.h"
+#include "PlacidSketch.h"
+#include "ground_truth_baseline.h"
+#include "TraceGenerator.h"
+#include "TraceFiles.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static void usage() {
+    fprintf(stderr, "usage: sweep (--trace DIR | --synthetic) [--total-kb LIST] [--stage1-ratio LIST] "
+                    "[--stage3-kb LIST] [--threads N] [--csv FILE] [--seed N] [--windows N] "
+                    "[--background-flows N] [--background-packets N] [--zipf X] [--planted N] "
+                    "[--mean-min X] [--mean-max X] [--duration-min N] [--duration-max N]\n");
+}
+
+// Comma-separated positive numbers; returns false on an empty list or a malformed entry
+static bool parseList(const char* text, vector<double>& values) {
+    values.clear();
+    const char* p = text;
+    while (*p) {
+        char* end = nullptr;
+        const double value = strtod(p, &end);
+        if (end == p || value <= 0.0 || (*end != ',' && *end != 0)) {
+            return false;
+        }
+        values.push_back(value);
+        p = *end ? end + 1 : end;
+    }
+    return !values.empty();
+}
+
+struct SweepJob {
+    size_t stage12Bytes;
+    double stage1Ratio;
+    size_t stage3Bytes;
+    double seconds = 0.0;  // processPacket and finalize only
+    vector<StableFlowReport> reports;
+};
+
+static void runJob(const SharedTrace& trace, SweepJob& job) {
+    const size_t stage1 = static_cast<size_t>(job.stage12Bytes * job.stage1Ratio);
+    unique_ptr<PlacidSketch<>> sketch(new PlacidSketch<>(stage1, job.stage12Bytes - stage1, job.stage3Bytes));
+    auto start = chrono::steady_clock::now();
+    auto collect = [&](const StableFlowReport& report) { job.reports.push_back(report); };
+    trace.replay([&](const char* flowID, uint32_t window) {
+        sketch->processPacket(flowID, window);
+        sketch->drainStableFlows(collect);
+    });
+    sketch->finalizeProcessing();
+    job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    sketch->drainStableFlows(collect);
+}
+
+int main(int argc, char** argv) {
+    string traceDir, csvPath;
+    bool synthetic = false;
+    vector<double> totalKb{STAGE1_2_TOTAL_MEMORY_BYTES / 1024.0};
+    vector<double> ratios{STAGE1_MEMORY_RATIO};
+    vector<double> stage3Kb{STAGE3_MEMORY_BYTES / 1024.0};
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    TraceConfig traceConfig = evaluationDefaults();
+
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--synthetic") {
+            synthetic = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+        if (arg == "--trace") traceDir = value;
+        else if (arg == "--csv") csvPath = value;
+        else if (arg == "--total-kb") ok = parseList(value, totalKb);
+        else if (arg == "--stage1-ratio") ok = parseList(value, ratios);
+        else if (arg == "--stage3-kb") ok = parseList(value, stage3Kb);
+        else if (arg == "--threads") threads = static_cast<unsigned>(strtoul(value, nullptr, 0));
+        else if (setTraceOption(traceConfig, arg, value)) continue;
+        else ok = false;
+        if (!ok) {
+            usage();
+            return 2;
+        }
+    }
+    const bool ratiosValid = all_of(ratios.begin(), ratios.end(), [](double r) { return r < 1.0; });
+    if (synthetic == !traceDir.empty() || threads == 0 || !ratiosValid || !validTraceConfig(traceConfig)) {
+        usage();
+        return 2;
+    }
+
+    // Load once: the shared table and the ground truth are both built from the same pass
+    SharedTrace trace;
+    GroundTruthConfig truthConfig;
+    truthConfig.threads = threads;
+    GroundTruthBaseline truth(truthConfig);
+    auto start = chrono::steady_clock::now();
+    bool ok = true;
+    auto load = [&](uint32_t window, const vector<Packet>& packets) {
+        ok = ok && trace.addWindow(window, packets) && truth.addWindow(window, packets);
+    };
+    if (synthetic) {
+        TraceGenerator(traceConfig).forEachWindow(threads, load);
+    } else {
+        vector<string> files;
+        if (!listWindowFiles(traceDir, files)) {
+            fprintf(stderr, "sweep: no window CSV files in %s\n", traceDir.c_str());
+            return 1;
+        }
+        string failed;
+        if (!forEachWindowFile(files, load, failed)) {
+            fprintf(stderr, "sweep: failed to read %s\n", failed.c_str());
+            return 1;
+        }
+    }
+    vector<StablePeriod> periods;
+    if (!ok || !truth.finish(periods)) {
+        fprintf(stderr, "sweep: loading the trace failed\n");
+        return 1;
+    }
+    trace.seal();
+    const double loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<SweepJob> jobs;
+    for (double total : totalKb) {
+        for (double ratio : ratios) {
+            for (double s3 : stage3Kb) {
+                SweepJob job;
+                job.stage12Bytes = static_cast<size_t>(total * 1024);
+                job.stage1Ratio = ratio;
+                job.stage3Bytes = static_cast<size_t>(s3 * 1024);
+                jobs.push_back(job);
+            }
+        }
+    }
+
+    // Jobs are claimed in order, so the largest configurations do not all land on one thread
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    const unsigned poolSize = static_cast<unsigned>(min<size_t>(threads, jobs.size()));
+    start = chrono::steady_clock::now();
+    for (unsigned t = 0; t < poolSize; ++t) {
+        workers.emplace_back([&] {
+            for (size_t j = next++; j < jobs.size(); j = next++) {
+                runJob(trace, jobs[j]);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const double sweepSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("%zu packets, %zu flows, %u windows loaded in %.1f s (%.1f MB shared)\n", trace.packets.size(),
+           trace.flows(), trace.windows(), loadSeconds,
+           trace.bytes() / 1048576.0);
+    printf("ground truth: %zu stable periods (>= %d subflows of %d windows)\n", periods.size(), Q, SUBFLOW_WINDOWS);
+    printf("%zu configurations in %.1f s on %u threads (Mpps is per configuration, with the others running)\n\n",
+           jobs.size(), sweepSeconds, poolSize);
+    printf("%10s %8s %10s %8s %8s %9s %7s %7s %10s %9s\n", "stage1+2", "ratio", "stage3", "Mpps", "reports",
+           "precision", "recall", "F1", "ARE(len)", "ARE(mean)");
+    FILE* csv = nullptr;
+    if (!csvPath.empty()) {
+        csv = fopen(csvPath.c_str(), "w");
+        if (!csv) {
+            fprintf(stderr, "sweep: cannot write %s\n", csvPath.c_str());
+            return 1;
+        }
+        fprintf(csv, "stage12_bytes,stage1_ratio,stage3_bytes,mpps,reports,precision,recall,f1,are_length,are_mean\n");
+    }
+    for (const auto& job : jobs) {
+        DetectionAccuracy acc = compareWithGroundTruth(periods, job.reports);
+        const double mpps = job.seconds > 0 ? trace.packets.size() / job.seconds / 1e6 : 0.0;
+        printf("%7zu KB %8.4f %7zu KB %8.2f %8zu %9.4f %7.4f %7.4f %10.4f %9.4f\n", job.stage12Bytes / 1024,
+               job.stage1Ratio, job.stage3Bytes / 1024, mpps, acc.reports, acc.precision, acc.recall, acc.f1,
+               acc.lengthARE, acc.meanARE);
+        if (csv) {
+            fprintf(csv, "%zu,%g,%zu,%.3f,%zu,%.6f,%.6f,%.6f,%.6f,%.6f\n", job.stage12Bytes, job.stage1Ratio,
+                    job.stage3Bytes, mpps, acc.reports, acc.precision, acc.recall, acc.f1, acc.lengthARE,
+                    acc.meanARE);
+        }
+    }
+    if (csv && fclose(csv) != 0) {
+        fprintf(stderr, "sweep: failed to write %s\n", csvPath.c_str());
+        return 1;
+    }
+    return 0;
+}
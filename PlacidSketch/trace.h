@@ -0,0 +1,46 @@
+#ifndef TRACE_H
+#define TRACE_H
+using namespace std;
+#include <cstdint>
+
+// Static tracepoints (SystemTap SDT / USDT) under the "placidsketch" provider. Each probe site
+// is a single nop until a tracer attaches, e.g.
+//   bpftrace -e 'usdt:./main:placidsketch:stage2_emit { @[arg1] = count(); }'
+// Built in when <sys/sdt.h> is available; -DPLACID_TRACE=0 removes them entirely.
+//
+// Probes and arguments (mean and variance are passed in thousandths, as integers):
+//   stage1_promote   flowID, window
+//   stage2_emit      flowID, startWindow, mean, variance
+//   stage3_merge     flowID, subflows in the cell after the merge
+//   stage3_reset     flowID, reason (0 window discontinuity, 1 merge rejected, 2 cell full)
+//   stage3_replace   new flowID, victim flowID, taken (0 when the probabilistic replacement skipped)
+//   stage3_report    flowID, startWindow, subflows
+//   window_rollover  closing window, next window
+#ifndef PLACID_TRACE
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PLACID_TRACE 1
+#endif
+#endif
+#endif
+#ifndef PLACID_TRACE
+#define PLACID_TRACE 0
+#endif
+
+#if PLACID_TRACE
+#include <sys/sdt.h>
+#define PLACID_PROBE2(name, a, b) DTRACE_PROBE2(placidsketch, name, a, b)
+#define PLACID_PROBE3(name, a, b, c) DTRACE_PROBE3(placidsketch, name, a, b, c)
+#define PLACID_PROBE4(name, a, b, c, d) DTRACE_PROBE4(placidsketch, name, a, b, c, d)
+#else
+#define PLACID_PROBE2(name, a, b) ((void)0)
+#define PLACID_PROBE3(name, a, b, c) ((void)0)
+#define PLACID_PROBE4(name, a, b, c, d) ((void)0)
+#endif
+
+// Fixed-point probe argument for a float statistic
+inline int64_t traceMilli(float value) {
+    return static_cast<int64_t>(value * 1000.0f);
+}
+
+#endif